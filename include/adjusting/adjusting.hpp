@@ -5,7 +5,11 @@
 #include "stream.hpp"
 #include "statistics.hpp"
 #include "merge_utils.hpp"
+#include "io_scheduler.hpp"
 #include "adjusting_writer.hpp"
+#include "adjusting_smoother.hpp"
+#include "perf_counters.hpp"
+#include "cancellation.hpp"
 
 namespace tongrams {
 
@@ -20,14 +24,20 @@ struct adjusting {
         , m_tmp_data(tmp_data)
         , m_stats(stats)
         , m_stats_builder(config, tmp_data, tmp_stats)
-        , m_writer(config, constants::file_extension::merged)
+        , m_writer(config, constants::file_extension::merged,
+                   tmp_data.num_run_ngrams *
+                       ngrams_block::record_size(config.max_order),
+                   tmp_data.tmp_usage,
+                   in_memory ? &tmp_data.merged_blocks : nullptr)
+        , m_smoother(m_stats_builder, m_writer)
         , m_comparator(config.max_order)
         , m_cursors(cursor_comparator_type(config.max_order))
         , m_CPU_time(0.0)
         , m_I_time(0.0)
         , m_O_time(0.0)
         , m_total_smooth_time(0.0)
-        , m_total_time_waiting_for_disk(0.0) {
+        , m_total_time_waiting_for_disk(0.0)
+        , m_merge_counters(config.perf_counters) {
         auto start = clock_type::now();
         size_t vocab_size = m_stats.num_ngrams(1);
         if (!vocab_size) {
@@ -42,32 +52,35 @@ struct adjusting {
     }
 
     typedef typename StreamGenerator::block_type input_block_type;
+    static constexpr bool in_memory =
+        std::is_same<StreamGenerator, stream::memory_stream_generator>::value;
 
     void print_stats() const {
         std::cout << "\"CPU\":" << m_CPU_time << ", ";
         std::cout << "\"I\":" << m_I_time << ", ";
         std::cout << "\"O\":" << m_O_time << ", ";
+        m_merge_counters.print("perf_merge");
+        m_writer.write_counters().print("perf_write");
     }
 
     void run() {
         auto start = clock_type::now();
         std::vector<std::string> filenames;
-        {
-            essentials::directory tmp_dir(m_config.tmp_dirname);
-            for (auto const& filename : tmp_dir) {
-                if (filename.extension == constants::file_extension::counts) {
-                    filenames.push_back(filename.fullpath);
-                }
-            }
-        }
+        if constexpr (!in_memory) filenames.swap(m_tmp_data.run_filenames);
 
-        size_t num_files_to_merge = filenames.size();
+        size_t num_files_to_merge =
+            in_memory ? m_tmp_data.counts_blocks.size() : filenames.size();
         assert(num_files_to_merge > 0);
-        std::cerr << "merging " << num_files_to_merge << " files" << std::endl;
+        std::cerr << "merging " << num_files_to_merge
+                  << (in_memory ? " blocks in memory" : " files") << std::endl;
 
+        typedef io_scheduler<StreamGenerator, context_order_comparator_type>
+            io_scheduler_type;
         uint64_t record_size = ngrams_block::record_size(m_config.max_order);
-        uint64_t min_load_size = m_config.RAM / (2 * num_files_to_merge + 1) /
-                                 record_size * record_size;
+        // besides the blocks buffered by the scheduler, the result block,
+        // the block in the smoother and the block in the writer are alive
+        uint64_t min_load_size = io_scheduler_type::max_load_size(
+            m_config.RAM, num_files_to_merge, 3, record_size);
         uint64_t default_load_size =
             (64 * essentials::MiB) / record_size * record_size;
         uint64_t load_size = default_load_size;
@@ -78,16 +91,37 @@ struct adjusting {
         }
         assert(load_size % record_size == 0);
 
+        uint64_t total_bytes = 0;
         for (auto const& filename : filenames) {
+            total_bytes += util::file_size(filename.c_str());
+        }
+        for (auto const& block : m_tmp_data.counts_blocks) {
+            total_bytes += block.size() * record_size;
+        }
+        m_tmp_data.progress.phase("adjusting", total_bytes, "bytes");
+
+        for (size_t k = 0; k != num_files_to_merge; ++k) {
             m_stream_generators.emplace_back(m_config.max_order);
             auto& gen = m_stream_generators.back();
-            gen.open(filename);
+            if constexpr (in_memory) {
+                std::deque<input_block_type> run;
+                run.push_back(std::move(m_tmp_data.counts_blocks[k]));
+                gen.open(run);
+            } else {
+                gen.open(filenames[k]);
+            }
             assert(gen.size() == 0);
-            gen.fetch_next_block(load_size);
         }
+        m_tmp_data.counts_blocks.clear();
+
+        io_scheduler_type scheduler(
+            m_stream_generators, m_config.max_order, load_size,
+            std::min<uint64_t>(m_config.num_threads,
+                               io_scheduler_type::max_io_workers),
+            m_tmp_data.progress);
 
-        auto get_block = [](StreamGenerator& gen) {
-            auto* block = gen.get_block();
+        auto get_block = [&](uint64_t k) {
+            auto* block = scheduler.get_block(k);
             assert(block->template is_sorted<context_order_comparator_type>(
                 block->begin(), block->end()));
             return block;
@@ -95,8 +129,7 @@ struct adjusting {
 
         assert(m_cursors.empty());
         for (uint64_t k = 0; k != m_stream_generators.size(); ++k) {
-            auto& gen = m_stream_generators[k];
-            auto* block = get_block(gen);
+            auto* block = get_block(k);
             cursor<typename input_block_type::iterator> c(block->begin(),
                                                           block->end(), k);
             m_cursors.push(c);
@@ -112,17 +145,6 @@ struct adjusting {
         result.reserve_index(num_ngrams_per_block);
         uint64_t limit = num_ngrams_per_block;
 
-        auto compute_left_extensions = [&]() {
-            assert(result.template is_sorted<context_order_comparator_type>(
-                result.begin(), result.end()));
-            auto start = clock_type::now();
-            m_stats_builder.compute_left_extensions(result.begin(),
-                                                    result.size());
-            auto end = clock_type::now();
-            std::chrono::duration<double> elapsed = end - start;
-            m_total_smooth_time += elapsed.count();
-        };
-
         uint64_t num_Ngrams = 0;
         uint64_t prev_offset = 0;
 
@@ -135,7 +157,9 @@ struct adjusting {
         };
 
         m_writer.start();
+        m_smoother.start();
 
+        perf::scope merge(m_merge_counters);
         while (!m_cursors.empty()) {
             auto& top = m_cursors.top();
             auto min = *(top.range.begin);
@@ -156,16 +180,16 @@ struct adjusting {
                     }
 
                     if (result.size() == num_ngrams_per_block) {
-                        compute_left_extensions();
+                        // the merged file is counted by the writer
+                        if (!in_memory) m_tmp_data.tmp_usage.check();
+
+                        // waits for the statistics stage
                         auto start = clock_type::now();
-                        while (m_writer.size() > 0)
-                            ;  // wait for flush
+                        m_smoother.push(result);
                         auto end = clock_type::now();
                         std::chrono::duration<double> elapsed = end - start;
                         m_total_time_waiting_for_disk += elapsed.count();
 
-                        m_writer.push(result);
-
                         result.init(N);
                         result.resize_memory(num_ngrams_per_block);
                         result.reserve_index(num_ngrams_per_block);
@@ -183,15 +207,18 @@ struct adjusting {
             ++(top.range.begin);
 
             if (top.range.begin == top.range.end) {
-                auto& gen = m_stream_generators[top.index];
-                gen.release_block();
-                if (gen.eos()) {
-                    assert(gen.empty());
-                    gen.close_and_remove();
+                cancellation::check();
+                scheduler.release_block(top.index);
+                if (scheduler.exhausted(top.index)) {
+                    auto& gen = m_stream_generators[top.index];
+                    gen.close();
+                    if constexpr (!in_memory) {
+                        // reclaim the space without stalling the merge
+                        m_tmp_data.reclaimer.remove(gen.filename());
+                    }
                     m_cursors.pop();
                 } else {
-                    gen.fetch_next_block(load_size);
-                    auto* block = get_block(gen);
+                    auto* block = get_block(top.index);
                     top.range.begin = block->begin();
                     top.range.end = block->end();
                 }
@@ -201,23 +228,32 @@ struct adjusting {
         }
 
         std::cerr << "MERGE DONE: " << num_Ngrams << " N-grams" << std::endl;
-        std::cerr << "\ttime waiting for disk = "
+        std::cerr << "\ttime waiting for the statistics stage = "
                   << m_total_time_waiting_for_disk << " [sec]\n";
-        std::cerr << "\tsmoothing time: " << m_total_smooth_time << " [sec]"
-                  << std::endl;
+        std::cerr << "\ttime waiting for runs = " << scheduler.waiting_time()
+                  << " [sec] (" << scheduler.num_fetches() << " fetches)\n";
 
         save_offsets();
-        compute_left_extensions();
-        m_stats_builder.finalize();
 
         auto end = clock_type::now();
         std::chrono::duration<double> elapsed = end - start;
         m_CPU_time += elapsed.count();
 
-        m_writer.push(result);
+        m_smoother.push(result);
+        m_smoother.terminate();
+        m_stats_builder.finalize();
         m_writer.terminate();
+        m_tmp_data.merged_filename = m_writer.filename();
+
+        m_total_smooth_time = m_smoother.time();
+        std::cerr << "\tsmoothing time: " << m_total_smooth_time << " [sec]"
+                  << " (waiting for disk: "
+                  << m_smoother.time_waiting_for_writer() << " [sec])"
+                  << std::endl;
+        m_CPU_time += m_total_smooth_time;
 
-        m_CPU_time -= m_total_time_waiting_for_disk;
+        // runs are read by the I/O threads of the scheduler, overlapped
+        m_CPU_time -= m_total_time_waiting_for_disk + scheduler.waiting_time();
         for (auto& sg : m_stream_generators) m_I_time += sg.I_time();
 
         start = clock_type::now();
@@ -225,7 +261,6 @@ struct adjusting {
         end = clock_type::now();
         elapsed = end - start;
         m_CPU_time += elapsed.count();
-        m_CPU_time -= m_I_time;
         m_O_time += m_writer.time();
     }
 
@@ -236,6 +271,7 @@ private:
     statistics::builder m_stats_builder;
     std::deque<StreamGenerator> m_stream_generators;
     adjusting_writer m_writer;
+    adjusting_smoother m_smoother;  // must follow the writer
     context_order_comparator_type m_comparator;
 
     min_heap<cursor<typename input_block_type::iterator>,
@@ -247,6 +283,7 @@ private:
     double m_O_time;
     double m_total_smooth_time;
     double m_total_time_waiting_for_disk;
+    perf::counters m_merge_counters;
 };
 
 }  // namespace tongrams
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "statistics.hpp"
+#include "adjusting_writer.hpp"
+#include "cancellation.hpp"
+
+namespace tongrams {
+
+/*
+    Pipeline stage between the merge and the writer: computes the left
+    extensions of the merged blocks, in merge order, on its own thread and
+    then hands the blocks over to the writer. The merge thread only merges.
+*/
+struct adjusting_smoother {
+    adjusting_smoother(statistics::builder& stats_builder,
+                       adjusting_writer& writer)
+        : m_stats_builder(stats_builder)
+        , m_writer(writer)
+        , m_time(0.0)
+        , m_time_waiting_for_writer(0.0) {}
+
+    ~adjusting_smoother() {
+        if (m_thread.joinable()) {  // stopped by an exception
+            m_buffer.abort();
+            m_thread.join();
+        }
+        if (!m_buffer.empty() and !std::uncaught_exceptions()) {
+            std::cerr << "Error: some blocks still need to be processed"
+                      << std::endl;
+            std::terminate();
+        }
+    }
+
+    void start() {
+        m_thread = std::thread(&adjusting_smoother::run, this);
+    }
+
+    void terminate() {
+        m_buffer.close();
+        if (m_thread.joinable()) m_thread.join();
+        run();  // if the thread was not started
+        m_buffer.check();
+        assert(m_buffer.empty());
+    }
+
+    void push(ngrams_block& block) {
+        m_buffer.push(block);  // waits for the previous block to be done
+    }
+
+    double time() const {
+        return m_time;
+    }
+
+    double time_waiting_for_writer() const {
+        return m_time_waiting_for_writer;
+    }
+
+private:
+    statistics::builder& m_stats_builder;
+    adjusting_writer& m_writer;
+    channel<ngrams_block> m_buffer;
+    std::thread m_thread;
+    double m_time;
+    double m_time_waiting_for_writer;
+
+    void run() {
+        try {
+            while (auto* block = m_buffer.front()) {
+                process(*block);
+                m_buffer.pop();
+            }
+        } catch (...) {  // rethrown on the producer thread
+            m_buffer.fail(std::current_exception());
+        }
+    }
+
+    void process(ngrams_block& block) {
+        if (!cancellation::requested()) {
+            assert(block.template is_sorted<context_order_comparator_type>(
+                block.begin(), block.end()));
+            auto start = clock_type::now();
+            m_stats_builder.compute_left_extensions(block.begin(),
+                                                    block.size());
+            auto end = clock_type::now();
+            std::chrono::duration<double> elapsed = end - start;
+            m_time += elapsed.count();
+
+            start = clock_type::now();
+            m_writer.push(block);
+            end = clock_type::now();
+            elapsed = end - start;
+            m_time_waiting_for_writer += elapsed.count();
+        }
+
+        block.release();
+    }
+};
+
+}  // namespace tongrams
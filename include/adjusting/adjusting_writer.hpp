@@ -2,23 +2,39 @@
 
 #include "configuration.hpp"
 #include "tmp.hpp"
+#include "file_stream.hpp"
+#include "perf_counters.hpp"
+#include "cancellation.hpp"
 
 namespace tongrams {
 
 struct adjusting_writer {
+    /*
+        [size] bytes, an upper bound to what will be written, are reserved
+        for the file and counted in [usage]. If [memory] is given, blocks
+        are moved there instead of being written.
+    */
     adjusting_writer(configuration const& config,
-                     std::string const& file_extension)
-        : m_num_flushes(0), m_time(0.0) {
-        m_buffer.open();
-        std::string output_filename =
+                     std::string const& file_extension, uint64_t size,
+                     tmp_space_usage& usage,
+                     std::deque<ngrams_block>* memory = nullptr)
+        : m_memory(memory)
+        , m_num_flushes(0)
+        , m_time(0.0)
+        , m_write_counters(config.perf_counters) {
+        if (m_memory) return;
+        m_filename =
             filename_generator(config.tmp_dirname, "", file_extension)();
-        m_os.open(output_filename.c_str(), std::ofstream::binary |
-                                               std::ofstream::ate |
-                                               std::ofstream::app);
+        tmp_files::created(m_filename);
+        m_os.open(m_filename, size, usage);
     }
 
     ~adjusting_writer() {
-        if (!m_buffer.empty()) {
+        if (m_thread.joinable()) {  // stopped by an exception
+            m_buffer.abort();
+            m_thread.join();
+        }
+        if (!m_buffer.empty() and !std::uncaught_exceptions()) {
             std::cerr << "Error: some data still need to be written"
                       << std::endl;
             std::terminate();
@@ -30,66 +46,79 @@ struct adjusting_writer {
     }
 
     void terminate() {
-        m_buffer.lock();
         m_buffer.close();
-        m_buffer.unlock();
         if (m_thread.joinable()) m_thread.join();
-        assert(!m_buffer.active());
-        while (!m_buffer.empty()) flush();
-        m_os.close();
+        run();  // if the thread was not started
+        m_buffer.check();
+        assert(m_buffer.empty());
+        if (m_os.is_open()) {
+            m_os.close();
+            if (!m_os) throw std::runtime_error("cannot write merged file");
+        }
         std::cerr << "\tadjusting_writer thread stats:\n";
         std::cerr << "\tflushed blocks: " << m_num_flushes << "\n";
         std::cerr << "\twrite time: " << m_time << "\n";
     }
 
     void push(ngrams_block& block) {
-        m_buffer.lock();
-        m_buffer.push(block);
-        m_buffer.unlock();
-    }
-
-    size_t size() {
-        m_buffer.lock();
-        size_t s = m_buffer.size();
-        m_buffer.unlock();
-        return s;
+        m_buffer.push(block);  // waits for the previous block to be done
     }
 
     double time() const {
         return m_time;
     }
 
+    // empty if the blocks are kept in memory
+    std::string const& filename() const {
+        return m_filename;
+    }
+
+    perf::counters const& write_counters() const {
+        return m_write_counters;
+    }
+
 private:
-    semi_sync_queue<ngrams_block> m_buffer;
-    std::ofstream m_os;
+    channel<ngrams_block> m_buffer;
+    std::deque<ngrams_block>* m_memory;
+    std::string m_filename;
+    preallocated_ofstream m_os;
     std::thread m_thread;
     uint64_t m_num_flushes;
     double m_time;
+    perf::counters m_write_counters;
 
     void run() {
-        while (m_buffer.active()) flush();
+        try {
+            while (auto* block = m_buffer.front()) {
+                flush(*block);
+                m_buffer.pop();
+            }
+        } catch (...) {  // rethrown on the producer thread
+            m_buffer.fail(std::current_exception());
+        }
     }
 
-    void flush() {
-        m_buffer.lock();
-        if (m_buffer.empty()) {
-            m_buffer.unlock();
+    void flush(ngrams_block& block) {
+        if (cancellation::requested()) {  // drop, do not write
+            block.release();
             return;
         }
-        auto& block = m_buffer.pick();
-        m_buffer.unlock();
 
         auto start = clock_type::now();
-        block.write_memory(m_os);
+        {
+            perf::scope write(m_write_counters);
+            if (m_memory) {
+                m_memory->push_back(std::move(block));
+            } else {
+                block.write_memory(m_os);
+            }
+        }
         auto end = clock_type::now();
         std::chrono::duration<double> elapsed = end - start;
         m_time += elapsed.count();
 
         block.release();
 
-        m_buffer.lock();
-        m_buffer.pop();
-        m_buffer.unlock();
         ++m_num_flushes;
         if (m_num_flushes % 20 == 0) {
             std::cerr << "flushed " << m_num_flushes << " blocks" << std::endl;
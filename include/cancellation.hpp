@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace tongrams::cancellation {
+
+/*
+    Process-wide cancellation token, set on SIGTERM or SIGINT.
+    Producer loops (reader, merge, last) call check() at block boundaries
+    and unwind with an exception; writer threads stop writing and drop the
+    blocks still queued, so that producers waiting for them are released.
+    If the process has not exited [timeout] seconds after the signal, or a
+    second signal arrives, it exits immediately.
+*/
+struct cancelled : std::runtime_error {
+    cancelled() : std::runtime_error("cancelled by signal") {}
+};
+
+std::atomic<int>& signal_number() {
+    static std::atomic<int> signum(0);
+    return signum;
+}
+
+bool requested() {
+    return signal_number().load(std::memory_order_relaxed) != 0;
+}
+
+void check() {
+    if (requested()) throw cancelled();
+}
+
+// exit status following the shell convention for signals
+int exit_code() {
+    return 128 + signal_number().load();
+}
+
+namespace detail {
+
+unsigned& timeout() {
+    static unsigned seconds = 0;
+    return seconds;
+}
+
+// only async-signal-safe calls in here
+void on_signal(int signum) {
+    int expected = 0;
+    if (!signal_number().compare_exchange_strong(expected, signum)) {
+        _exit(128 + expected);  // second signal: give up on cleaning
+    }
+    static const char msg[] = "caught signal: stopping\n";
+    ssize_t r = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    (void)r;
+    if (timeout()) alarm(timeout());
+}
+
+void on_timeout(int) {
+    static const char msg[] = "could not stop in time: exiting\n";
+    ssize_t r = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    (void)r;
+    _exit(128 + signal_number().load());
+}
+
+}  // namespace detail
+
+void install(unsigned timeout) {
+    detail::timeout() = timeout;
+    struct sigaction sa;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = detail::on_signal;
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+    sa.sa_handler = detail::on_timeout;
+    sigaction(SIGALRM, &sa, nullptr);
+}
+
+}  // namespace tongrams::cancellation
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+#include "../external/tongrams/external/cmd_line_parser/include/parser.hpp"
+
+#include "configuration.hpp"
+#include "util.hpp"
+
+namespace tongrams {
+
+typedef cmd_line_parser::parser parser_type;
+
+uint64_t available_ram() {
+    return sysconf(_SC_PAGESIZE) * sysconf(_SC_PHYS_PAGES);
+}
+
+/*
+    Options shared by the tools that count a text: [step] names what the
+    tool does with the RAM and the temporary directory.
+*/
+void add_counting_options(parser_type& parser, configuration const& config,
+                          std::string const& step) {
+    parser.add("text_filename", "Input text filename.");
+    parser.add("order", "Language model order. It must be > 2 and <= " +
+                            std::to_string(global::max_order) + ".");
+    parser.add("ram",
+               "Amount to RAM dedicated to " + step + " in GiB. Default is " +
+                   std::to_string(static_cast<uint64_t>(
+                       static_cast<double>(config.RAM) / essentials::GiB)) +
+                   " GiB.",
+               "--ram", false);
+    parser.add("tmp_dir",
+               "Temporary directory used for " + step +
+                   ". Default is directory '" +
+                   constants::default_tmp_dirname + "'.",
+               "--tmp", false);
+    parser.add("num_threads",
+               "Number of threads. Default is " +
+                   std::to_string(config.num_threads) + " on this machine.",
+               "--thr", false);
+    parser.add("compress_blocks",
+               "Compress temporary files during " + step + ". Default is " +
+                   (config.compress_blocks ? std::string("true")
+                                           : std::string("false")) +
+                   ".",
+               "--compress_blocks", true);
+    parser.add("perf_counters",
+               "Sample hardware performance counters (cycles, instructions, "
+               "LLC misses, dTLB misses, branch misses) for each step.",
+               "--perf", true);
+    parser.add("sentences",
+               "Treat each line as a sentence, counted on its own: it is "
+               "padded with <s> on the left and terminated by </s>. Default "
+               "is to treat the whole text as one stream of words.",
+               "--sentences", true);
+    parser.add("dedup_lines",
+               "Skip exact duplicate lines, remembered in a table that takes "
+               "10% of the RAM. Default is false.",
+               "--dedup", true);
+    parser.add("max_vocab",
+               "Keep only this many of the most frequent words; map the others "
+               "to <unk>. Default is no limit.",
+               "--max_vocab", false);
+    parser.add("min_unigram_count",
+               "Map the words occurring fewer than this many times to <unk>. "
+               "Default is 1.",
+               "--min_unigram_count", false);
+    parser.add("singletons",
+               "Store N-grams seen once in a block as bare words, behind a "
+               "Bloom filter, and move them into the hash table only when "
+               "seen again: blocks hold more distinct N-grams with the same "
+               "RAM. Default is false.",
+               "--singletons", true);
+    parser.add("progress",
+               "Report progress and ETA every this many seconds. "
+               "Default is no reporting.",
+               "--progress", false);
+    parser.add("status_filename",
+               "Write progress to this file (in JSON format) instead of "
+               "std::cerr. It is replaced at every report, every 10 seconds "
+               "unless specified otherwise with --progress.",
+               "--status", false);
+    parser.add("tmp_limit",
+               "Maximum amount of temporary files in GiB. If exceeded, the "
+               "run stops and removes them. Default is no limit.",
+               "--tmp_limit", false);
+    parser.add("shutdown_timeout",
+               "On SIGTERM or SIGINT, exit anyway after this many seconds "
+               "if temporary files are not yet removed. Default is " +
+                   std::to_string(config.shutdown_timeout) + " seconds.",
+               "--shutdown_timeout", false);
+    parser.add("out",
+               "Output filename. Default is '" +
+                   constants::default_output_filename + "'.",
+               "--out", false);
+}
+
+// false if an option has an invalid value: the error is already reported
+bool parse_counting_options(parser_type& parser, configuration& config) {
+    config.text_filename = parser.get<std::string>("text_filename");
+    if (!util::exists(config.text_filename.c_str())) {
+        std::cerr << "Error: corpus file does not exist" << std::endl;
+        return false;
+    }
+
+    config.text_size = util::file_size(config.text_filename.c_str());
+    std::cerr << "reading from '" << config.text_filename << "' ("
+              << config.text_size << " bytes)" << std::endl;
+    config.max_order = parser.get<uint64_t>("order");
+    if (config.max_order <= 2 or config.max_order > global::max_order) {
+        std::cerr << "invalid language model order" << std::endl;
+        return false;
+    }
+
+    if (parser.parsed("ram")) {
+        uint64_t ram =
+            static_cast<uint64_t>(parser.get<double>("ram") * essentials::GiB);
+        if (ram > available_ram()) {
+            std::cerr << "Warning: this machine has "
+                      << available_ram() / essentials::GiB << " GiB of RAM."
+                      << std::endl;
+            std::cerr << "Thus, using defalt amount of "
+                      << config.RAM / essentials::GiB << " GiB" << std::endl;
+        } else {
+            config.RAM = ram;
+        }
+    }
+    if (parser.parsed("tmp_dir")) {
+        config.tmp_dirname = parser.get<std::string>("tmp_dir");
+    }
+    if (parser.parsed("num_threads")) {
+        config.num_threads = parser.get<uint64_t>("num_threads");
+        if (config.num_threads == 0) {
+            std::cerr << "number of threads must be > 0" << std::endl;
+            return false;
+        }
+    }
+    if (parser.parsed("compress_blocks")) {
+        config.compress_blocks = parser.get<bool>("compress_blocks");
+    }
+    if (parser.parsed("perf_counters")) {
+        config.perf_counters = parser.get<bool>("perf_counters");
+    }
+    if (parser.parsed("sentences")) {
+        config.sentences = parser.get<bool>("sentences");
+    }
+    if (parser.parsed("dedup_lines")) {
+        config.dedup_lines = parser.get<bool>("dedup_lines");
+    }
+    if (parser.parsed("max_vocab")) {
+        config.max_vocab = parser.get<uint64_t>("max_vocab");
+    }
+    if (parser.parsed("min_unigram_count")) {
+        config.min_unigram_count = parser.get<uint64_t>("min_unigram_count");
+    }
+    if (parser.parsed("singletons")) {
+        config.singletons = parser.get<bool>("singletons");
+    }
+    if (parser.parsed("progress")) {
+        config.progress_interval = parser.get<double>("progress");
+    }
+    if (parser.parsed("status_filename")) {
+        config.status_filename = parser.get<std::string>("status_filename");
+        if (config.progress_interval <= 0.0) config.progress_interval = 10.0;
+    }
+    if (parser.parsed("tmp_limit")) {
+        config.tmp_limit = static_cast<uint64_t>(
+            parser.get<double>("tmp_limit") * essentials::GiB);
+    }
+    if (parser.parsed("shutdown_timeout")) {
+        config.shutdown_timeout = parser.get<uint64_t>("shutdown_timeout");
+    }
+    if (parser.parsed("out")) {
+        config.output_filename = parser.get<std::string>("out");
+    }
+    return true;
+}
+
+}  // namespace tongrams
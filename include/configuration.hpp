@@ -17,6 +17,15 @@ struct configuration {
         , vocab_filename("/vocabulary")
         , output_filename(constants::default_output_filename)
         , compress_blocks(false)
+        , perf_counters(false)
+        , sentences(false)
+        , dedup_lines(false)
+        , max_vocab(0)
+        , min_unigram_count(1)
+        , singletons(false)
+        , progress_interval(0.0)
+        , tmp_limit(0)
+        , shutdown_timeout(30)
         , probs_quantization_bits(global::default_probs_quantization_bits)
         , backoffs_quantization_bits(
               global::default_backoffs_quantization_bits) {}
@@ -31,6 +40,16 @@ struct configuration {
     std::string text_filename;
     std::string output_filename;
     bool compress_blocks;
+    bool perf_counters;
+    bool sentences;  // count each line as a sentence: <s> ... </s>
+    bool dedup_lines;  // skip exact duplicate lines
+    uint64_t max_vocab;  // 0 for no limit; other words are mapped to <unk>
+    uint64_t min_unigram_count;  // rarer words are mapped to <unk>
+    bool singletons;  // keep N-grams seen once out of the hash table
+    double progress_interval;  // in seconds, 0 to disable
+    std::string status_filename;
+    uint64_t tmp_limit;  // in bytes, 0 for no limit
+    uint64_t shutdown_timeout;  // in seconds, 0 to wait indefinitely
     uint8_t probs_quantization_bits;
     uint8_t backoffs_quantization_bits;
 };
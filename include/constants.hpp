@@ -24,5 +24,15 @@ static const byte_range empty_token_byte_range{
     reinterpret_cast<uint8_t const*>(empty_token.c_str()),
     reinterpret_cast<uint8_t const*>(empty_token.c_str()) + empty_token.size()};
 
+// sentence mode: each line is a sentence, padded with <s> on the left and
+// terminated by </s>; <s> takes the place of the empty token
+static const std::string begin_of_sentence("<s>");
+static const std::string end_of_sentence("</s>");
+static const word_id begin_of_sentence_word_id = empty_token_word_id;
+static const word_id end_of_sentence_word_id = empty_token_word_id + 1;
+
+// the words left out of the vocabulary
+static const std::string unknown_word("<unk>");
+
 }  // namespace constants
 }  // namespace tongrams
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "vocabulary.hpp"
+#include "perf_counters.hpp"
+#include "cancellation.hpp"
 #include "tmp.hpp"
 #include "statistics.hpp"
 #include "stream.hpp"
@@ -23,9 +25,13 @@ struct counter {
         std::cout << "\"order\":" << config.max_order << ", ";
         std::cout << "\"RAM\":" << config.RAM << ", ";
         std::cout << "\"threads\":" << config.num_threads;
+        m_tmp_data.progress.start(config.progress_interval,
+                                  config.status_filename);
+        m_tmp_data.tmp_usage.set_limit(config.tmp_limit);
     }
 
     ~counter() {
+        std::cout << ", \"tmp_peak\":" << m_tmp_data.tmp_usage.peak();
         std::cout << "}" << std::endl;
     }
 
@@ -40,14 +46,18 @@ struct counter {
         }
 
         m_stats.num_ngrams(1) = m_tmp_data.word_ids.size();
-        m_tmp_data.word_ids.clear();
+        m_tmp_data.release_word_ids();
         // write_vocab();
 
-        if (m_config.compress_blocks) {
+        if (!m_tmp_data.counts_blocks.empty()) {  // all runs fit in memory
+            run<merging<stream::memory_stream_generator>>("merging");
+        } else if (m_config.compress_blocks) {
             run<merging<stream::compressed_stream_generator>>("merging");
         } else {
             run<merging<stream::uncompressed_stream_generator>>("merging");
         }
+
+        m_tmp_data.progress.finish();
     }
 
     void print_stats() {
@@ -67,16 +77,31 @@ private:
 
     template <typename Step>
     void run(std::string const& name) {
+        cancellation::check();
         std::cout << ", ";
         std::cout << "\"" + name + "\": {";
+        std::cout << "\"rss_before\":" << util::resident_set_size() << ", ";
+        perf::counters step_counters(m_config.perf_counters);
         auto start = clock_type::now();
-        Step step(m_config, m_tmp_data, m_tmp_stats, m_stats);
-        step.run();
-        auto end = clock_type::now();
-        std::chrono::duration<double> elapsed = end - start;
-        double total_time = elapsed.count();
-        m_timings.push_back(total_time);
-        std::cout << "\"total\":" << total_time;
+        double total_time = 0.0;
+        {
+            // opened before the step is built and closed after it is
+            // destroyed, so that the threads its stages start and join
+            // are counted; threads that already exist, such as the
+            // reclaimer of temporary files, are not
+            perf::scope s(step_counters, true);
+            Step step(m_config, m_tmp_data, m_tmp_stats, m_stats);
+            step.run();
+            auto end = clock_type::now();
+            std::chrono::duration<double> elapsed = end - start;
+            total_time = elapsed.count();
+            m_timings.push_back(total_time);
+            step.print_stats();
+        }
+        step_counters.print("perf");
+        util::trim_memory();  // what the step freed goes back to the OS
+        std::cout << "\"total\":" << total_time << ", ";
+        std::cout << "\"rss_after\":" << util::resident_set_size();
         std::cout << "}";
     }
 
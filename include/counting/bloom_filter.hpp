@@ -0,0 +1,46 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+namespace tongrams {
+
+// bits of a Bloom filter, addressed by an already computed 64-bit hash
+struct bloom_filter {
+    static constexpr uint64_t num_hashes = 3;
+
+    bloom_filter() : m_mask(0) {}
+
+    // [num_bits] is rounded up to a power of 2
+    void init(uint64_t num_bits) {
+        uint64_t n = 64;
+        while (n < num_bits) n *= 2;
+        m_bits.assign(n / 64, 0);
+        m_mask = n - 1;
+    }
+
+    // set the bits of [hash]: true if they were all set already, i.e., if
+    // the key was possibly inserted before
+    bool test_and_set(uint64_t hash) {
+        uint64_t step = (hash >> 32) | 1;
+        bool present = true;
+        for (uint64_t i = 0; i != num_hashes; ++i, hash += step) {
+            uint64_t pos = hash & m_mask;
+            uint64_t bit = uint64_t(1) << (pos & 63);
+            uint64_t& word = m_bits[pos >> 6];
+            present = present and (word & bit);
+            word |= bit;
+        }
+        return present;
+    }
+
+    void clear() {
+        std::fill(m_bits.begin(), m_bits.end(), 0);
+    }
+
+private:
+    std::vector<uint64_t> m_bits;
+    uint64_t m_mask;
+};
+
+}  // namespace tongrams
@@ -23,13 +23,29 @@ struct counting {
         , m_CPU_time(0.0)
         , m_I_time(0.0)
         , m_writer(config, tmp_data, constants::file_extension::counts)
-        , m_reader(config, tmp_data, m_writer) {
-        tmp_data.vocab_builder.push_empty();
-        tmp_data.word_ids[hash_utils::hash_empty_token] =
-            constants::empty_token_word_id;
+        , m_reader(config, tmp_data, m_writer, m_filter)
+        , m_tmp_data(tmp_data) {
+        if (config.sentences) {
+            stl_string_adaptor adaptor;
+            for (auto const& token : {constants::begin_of_sentence,
+                                      constants::end_of_sentence}) {
+                byte_range range = adaptor(token);
+                tmp_data.word_ids[hash_utils::byte_range_hash64(range)] =
+                    tmp_data.vocab_builder.size();
+                tmp_data.vocab_builder.push_back(range);
+            }
+            assert(tmp_data.vocab_builder.size() ==
+                   constants::end_of_sentence_word_id + 1);
+        } else {
+            tmp_data.vocab_builder.push_empty();
+            tmp_data.word_ids[hash_utils::hash_empty_token] =
+                constants::empty_token_word_id;
+        }
     }
 
     void run() {
+        m_filter.build(m_config);
+
         bool file_begin = true;
         bool file_end = false;
         static constexpr uint64_t mm_region_size = 1 * essentials::GiB;
@@ -37,6 +53,7 @@ struct counting {
         uint64_t page_size = sysconf(_SC_PAGESIZE);
         assert(mm_region_size >= page_size and mm_region_size % page_size == 0);
 
+        m_tmp_data.progress.phase("counting", m_config.text_size, "bytes");
         m_writer.start();
 
         for (uint64_t block = 0,
@@ -85,17 +102,30 @@ struct counting {
         std::cout << "\"CPU\":" << m_CPU_time << ", ";
         std::cout << "\"I\":" << m_I_time << ", ";
         std::cout << "\"O\":" << m_writer.O_time() << ", ";
+        if (m_config.dedup_lines) m_reader.duplicates().print_stats();
+        if (m_filter.enabled()) m_filter.print_stats();
+        m_reader.probe_counters().print("perf_probe");
+        m_writer.sort_counters().print("perf_sort");
+        m_writer.write_counters().print("perf_write");
     }
 
 private:
+    // partitions end at word boundaries, or at line boundaries in sentence
+    // mode and when skipping duplicate lines, so that each line is seen
+    // whole by one reader
+    bool is_separator(uint8_t c) const {
+        return c == '\n' or
+               (c == ' ' and !m_config.sentences and !m_config.dedup_lines);
+    }
+
     bool is_aligned(uint64_t pos) const {
-        return m_data[pos] == ' ' or m_data[pos] == '\n';
+        return is_separator(m_data[pos]);
     }
 
     void align_forward(uint64_t& begin) {
         for (;; ++begin) {
             auto c = m_data[begin];
-            if (c == ' ' or c == '\n') {
+            if (is_separator(c)) {
                 ++begin;  // first char after a whitespace
                 break;
             }
@@ -106,7 +136,7 @@ private:
     void align_backward(uint64_t begin, uint64_t& end) {
         for (; begin != end; --end) {
             auto c = m_data[end];
-            if (c == ' ' or c == '\n') {
+            if (is_separator(c)) {
                 ++end;  // one-past
                 std::reverse(m_boundary.begin(), m_boundary.end());
                 break;
@@ -124,10 +154,12 @@ private:
     double m_CPU_time;
     double m_I_time;
 
+    vocabulary_filter m_filter;
     typedef counting_writer<BlockWriter, Comparator> counting_writer_type;
     typedef counting_reader<counting_writer_type> counting_reader_type;
     counting_writer_type m_writer;
     counting_reader_type m_reader;
+    tmp::data& m_tmp_data;
 };
 
 }  // namespace tongrams
@@ -1,31 +1,74 @@
 #pragma once
 
+#include <cstring>
+#include <limits>
+
 #include "counting_common.hpp"
 #include "configuration.hpp"
 #include "tmp.hpp"
 #include "sliding_window.hpp"
+#include "duplicate_lines.hpp"
+#include "vocabulary_filter.hpp"
+#include "bloom_filter.hpp"
+#include "perf_counters.hpp"
+#include "cancellation.hpp"
 
 namespace tongrams {
 
 template <typename Writer>
 struct counting_reader {
     counting_reader(configuration const& config, tmp::data& tmp_data,
-                    Writer& thread)
+                    Writer& thread, vocabulary_filter& filter)
         : m_tmp_data(tmp_data)
+        , m_filter(filter)
         , m_window(config.max_order)
         , m_max_order(config.max_order)
+        , m_sentences(config.sentences)
+        , m_dedup_lines(config.dedup_lines)
+        , m_count_singletons(config.singletons)
+        , m_in_sentence(false)
         , m_writer(thread)
-        , m_next_word_id(constants::empty_token_word_id + 1)
-        , m_CPU_time(0.0) {
+        , m_next_word_id(config.sentences
+                             ? constants::end_of_sentence_word_id + 1
+                             : constants::empty_token_word_id + 1)
+        , m_CPU_time(0.0)
+        , m_probe_counters(config.perf_counters) {
         m_window.fill(constants::empty_token_word_id);
-        static constexpr double weight = 0.9;
+        // the table of duplicate lines takes its share of the blocks' RAM
+        static constexpr double dedup_weight = 0.1;
+        double weight = 0.9;
+        if (m_dedup_lines) {
+            weight -= dedup_weight;
+            m_duplicates.init(dedup_weight * config.RAM);
+        }
         size_t bytes_per_ngram = sizeof_ngram(config.max_order) +
                                  sizeof(count_type) +  // payload
                                  sizeof(word_id*) +    // pointer
                                  sizeof(ngram_id);     // hashset
-        m_num_ngrams_per_block = ((weight * config.RAM) /
-                                  (2 * hash_utils::probing_space_multiplier)) /
-                                 bytes_per_ngram;
+        uint64_t block_bytes = (weight * config.RAM) /
+                               (2 * hash_utils::probing_space_multiplier);
+        m_num_ngrams_per_block = block_bytes / bytes_per_ngram;
+        m_num_singletons_per_block = 0;
+        if (m_count_singletons) {
+            // most distinct N-grams occur once: a third of the block goes
+            // to the hash table, the rest to the singletons, which take
+            // their words, about a byte of filter and the pointer they are
+            // sorted by in the writer
+            m_num_ngrams_per_block = block_bytes / 3 / bytes_per_ngram;
+            m_num_singletons_per_block =
+                2 * block_bytes / 3 /
+                (sizeof_ngram(config.max_order) + 1 + sizeof(ngram_pointer));
+        }
+        // tokens are separated, thus there are at most text_size / 2 + 1
+        // of them: do not allocate more than needed for small corpora
+        uint64_t max_num_ngrams = config.text_size / 2 + 1 + config.max_order;
+        if (m_num_ngrams_per_block > max_num_ngrams) {
+            m_num_ngrams_per_block = max_num_ngrams;
+        }
+        if (m_num_singletons_per_block > max_num_ngrams) {
+            m_num_singletons_per_block = max_num_ngrams;
+        }
+        if (m_count_singletons) m_seen.init(8 * m_num_singletons_per_block);
     }
 
     void init(uint8_t const* data, std::string const& boundary,
@@ -33,24 +76,29 @@ struct counting_reader {
               bool file_end) {
         auto s = clock_type::now();
         m_partition_end = partition_end;
+        m_reported_position = partition_begin;
         m_file_begin = file_begin;
         m_file_end = file_end;
         assert(partition_begin <= partition_end);
         m_counts.init(m_max_order, m_num_ngrams_per_block);
-        if (file_begin) count();  // count empty window
-        m_window.init({data + partition_begin, data + m_partition_end},
-                      partition_begin);
+        m_counts.reserve_singletons(m_num_singletons_per_block);
+        if (file_begin and !m_sentences) count();  // count empty window
 
+        // the boundary is the word, or the line in sentence mode or when
+        // skipping duplicate lines, that straddles the previous partition
         if (!boundary.empty()) {
-            m_window.shift();
             stl_string_adaptor adaptor;
             byte_range range = adaptor(boundary);
-            uint64_t hash = hash_utils::byte_range_hash64(range);
-            auto id = find_or_insert(range, hash);
-            m_window.eat(id);
-            count();
+            if (!m_dedup_lines or !m_duplicates.seen(range)) {
+                m_window.init(range, partition_begin);
+                while (advance()) count();
+                if (m_sentences) end_sentence();
+            }
         }
 
+        m_text = {data + partition_begin, data + m_partition_end};
+        m_window.init(m_text, partition_begin);
+
         auto e = clock_type::now();
         std::chrono::duration<double> diff = e - s;
         m_CPU_time += diff.count();
@@ -63,8 +111,27 @@ struct counting_reader {
     }
 
     void run() {
+        perf::scope probe(m_probe_counters);
         auto s = clock_type::now();
-        while (advance()) count();
+        if (m_dedup_lines) {
+            uint64_t position = m_reported_position;
+            for (uint8_t const* begin = m_text.first; begin != m_text.second;) {
+                auto end = static_cast<uint8_t const*>(
+                    std::memchr(begin, '\n', m_text.second - begin));
+                if (!end) end = m_text.second;
+                uint8_t const* next = end + (end != m_text.second);
+                if (end != begin and !m_duplicates.seen({begin, end})) {
+                    m_window.seek({begin, next}, position);
+                    count_words();
+                }
+                position += next - begin;
+                begin = next;
+            }
+        } else {
+            count_words();
+        }
+        report_progress();
+        if (m_sentences) end_sentence();
 
         // NOTE: if we are at the end of file,
         // add [m_max_order - 1] ngrams padded with empty tokens,
@@ -73,7 +140,7 @@ struct counting_reader {
         // w_{m-2} w_{m-1} w_m </> </>
         // w_{m-1} w_m </> </> </>
         // w_m </> </> </> </>
-        if (m_file_end) {
+        if (m_file_end and !m_sentences) {
             assert(m_max_order > 0);
             for (uint8_t i = 0; i != m_max_order - 1; ++i) {
                 m_window.shift();
@@ -98,23 +165,54 @@ struct counting_reader {
         return m_window.time();
     }
 
+    perf::counters const& probe_counters() const {
+        return m_probe_counters;
+    }
+
+    duplicate_lines const& duplicates() const {
+        return m_duplicates;
+    }
+
 private:
     tmp::data& m_tmp_data;
+    vocabulary_filter& m_filter;
     sliding_window m_window;
     uint8_t m_max_order;
+    bool m_sentences;
+    bool m_dedup_lines;
+    bool m_count_singletons;
+    bool m_in_sentence;
     Writer& m_writer;
     word_id m_next_word_id;
     double m_CPU_time;
+    perf::counters m_probe_counters;
 
     uint64_t m_partition_end;
+    uint64_t m_reported_position;
     uint64_t m_num_ngrams_per_block;
+    uint64_t m_num_singletons_per_block;
+    bloom_filter m_seen;  // N-grams of the current block
     bool m_file_begin, m_file_end;
     counting_step::block_type m_counts;
+    byte_range m_text;  // of the current partition
+    duplicate_lines m_duplicates;
 
     word_id find_or_insert(byte_range range, uint64_t hash) {
         word_id id = m_next_word_id;
         auto it = m_tmp_data.word_ids.find(hash);
+        if (it == m_tmp_data.word_ids.end() and !m_filter.keeps(hash)) {
+            stl_string_adaptor adaptor;
+            range = adaptor(constants::unknown_word);
+            hash = hash_utils::byte_range_hash64(range);
+            it = m_tmp_data.word_ids.find(hash);
+        }
         if (it == m_tmp_data.word_ids.end()) {
+            // word_id(-1) is reserved as invalid
+            if (m_next_word_id == std::numeric_limits<word_id>::max()) {
+                throw std::runtime_error(
+                    "vocabulary too large for " +
+                    std::to_string(8 * sizeof(word_id)) + "-bit word ids");
+            }
             m_tmp_data.word_ids[hash] = m_next_word_id;
             m_tmp_data.vocab_builder.push_back(range);
             ++m_next_word_id;
@@ -125,19 +223,72 @@ private:
         return id;
     }
 
+    void count_words() {
+        while (advance()) {
+            count();
+            if (m_window.position() - m_reported_position >=
+                progress_granularity) {
+                report_progress();
+                cancellation::check();
+            }
+        }
+    }
+
     bool advance() {
         if (!m_window.advance()) return false;
         auto const& word = m_window.last();
         assert(word.hash != constants::invalid_hash);
         auto id = find_or_insert(word.range, word.hash);
         assert(id < m_next_word_id);
+        if (m_sentences and m_window.begins_line()) {
+            // the window is already shifted: end the previous sentence in
+            // place, then start the new one from a window full of <s>
+            if (m_in_sentence) {
+                m_window.eat(constants::end_of_sentence_word_id);
+                count();
+            }
+            m_window.fill(constants::begin_of_sentence_word_id);
+            count();
+            m_in_sentence = true;
+        }
         m_window.eat(id);
         return true;
     }
 
+    void end_sentence() {
+        if (!m_in_sentence) return;
+        m_window.shift();
+        m_window.eat(constants::end_of_sentence_word_id);
+        count();
+        m_in_sentence = false;
+    }
+
+    static constexpr uint64_t progress_granularity = essentials::MiB;
+
+    void report_progress() {
+        uint64_t position = std::min(m_window.position(), m_partition_end);
+        if (position <= m_reported_position) return;
+        m_tmp_data.progress.add(position - m_reported_position);
+        m_reported_position = position;
+    }
+
+    /*
+        When counting singletons, an N-gram seen for the first time in the
+        block, according to the filter, is appended to the singletons of
+        the block; only when it is seen again it enters the hash table. The
+        writer adds up the two when sorting the block. A false positive of
+        the filter just puts an N-gram in the hash table right away.
+    */
     void count() {
         uint64_t hash =
             hash_utils::hash64(m_window.data(), sizeof_ngram(m_max_order));
+        if (m_count_singletons and !m_seen.test_and_set(hash)) {
+            m_counts.push_singleton(m_window.data());
+            if (m_counts.num_singletons() == m_num_singletons_per_block) {
+                push_block();
+            }
+            return;
+        }
         auto [found, at] = m_counts.find_or_insert(m_window.get(), hash);
         if (found) {
             auto count = ++m_counts[at];
@@ -148,13 +299,18 @@ private:
     }
 
     void push_block() {
-        while (m_writer.size() > 0)
-            ;  // wait for flush
+        cancellation::check();
+        m_tmp_data.tmp_usage.check();
         counting_step::block_type tmp;
-        tmp.init(m_max_order, m_num_ngrams_per_block);
         tmp.swap(m_counts);
         tmp.release_hash_index();
-        m_writer.push(tmp);
+        m_writer.push(tmp);  // waits for the previous block to be flushed
+
+        // allocate the next block only once the writer holds a single
+        // one: the blocks are sized for two alive at once
+        m_counts.init(m_max_order, m_num_ngrams_per_block);
+        m_counts.reserve_singletons(m_num_singletons_per_block);
+        if (m_count_singletons) m_seen.clear();
     }
 };
 
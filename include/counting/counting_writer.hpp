@@ -3,7 +3,11 @@
 #include "counting_common.hpp"
 #include "configuration.hpp"
 #include "tmp.hpp"
+#include "file_stream.hpp"
+#include "stream.hpp"
 #include "comparators.hpp"
+#include "perf_counters.hpp"
+#include "cancellation.hpp"
 
 namespace tongrams {
 
@@ -16,13 +20,22 @@ struct counting_writer {
         , m_O_time(0.0)
         , m_CPU_time(0.0)
         , m_num_flushes(0)
+        , m_order(config.max_order)
+        , m_in_memory(true)
+        , m_memory_budget(config.RAM / 4)
+        , m_retained_bytes(0)
+        , m_sort_counters(config.perf_counters)
+        , m_write_counters(config.perf_counters)
         , m_writer(config.max_order)
-        , m_comparator(config.max_order) {
-        m_buffer.open();
-    }
+        , m_comparator(config.max_order)
+        , m_scratch(2 * ngrams_block::record_size(config.max_order)) {}
 
     ~counting_writer() {
-        if (!m_buffer.empty()) {
+        if (m_thread.joinable()) {  // stopped by an exception
+            m_buffer.abort();
+            m_thread.join();
+        }
+        if (!m_buffer.empty() and !std::uncaught_exceptions()) {
             std::cerr << "Error: some data still need to be written"
                       << std::endl;
             std::terminate();
@@ -34,12 +47,16 @@ struct counting_writer {
     }
 
     void terminate() {
-        m_buffer.lock();
         m_buffer.close();
-        m_buffer.unlock();
         if (m_thread.joinable()) m_thread.join();
-        assert(!m_buffer.active());
-        while (!m_buffer.empty()) flush();
+        run();  // if the thread was not started
+        m_buffer.check();
+        assert(m_buffer.empty());
+        if (in_memory()) {
+            std::cerr << "\tall " << m_tmp_data.counts_blocks.size()
+                      << " sorted blocks fit in memory (" << m_retained_bytes
+                      << " bytes): no temporary files" << std::endl;
+        }
         std::cerr << "\tcounting_writer thread stats:\n";
         std::cerr << "\tflushed blocks: " << m_num_flushes << "\n";
         std::cerr << "\tO time: " << m_O_time << "\n";
@@ -47,16 +64,12 @@ struct counting_writer {
     }
 
     void push(counting_step::block_type& block) {
-        m_buffer.lock();
-        m_buffer.push(block);
-        m_buffer.unlock();
+        m_buffer.push(block);  // waits for the previous block to be done
     }
 
-    size_t size() {
-        m_buffer.lock();
-        size_t s = m_buffer.size();
-        m_buffer.unlock();
-        return s;
+    // true if no run has been written to disk
+    bool in_memory() const {
+        return m_in_memory and !m_tmp_data.counts_blocks.empty();
     }
 
     double CPU_time() const {
@@ -67,61 +80,284 @@ struct counting_writer {
         return m_O_time;
     }
 
+    perf::counters const& sort_counters() const {
+        return m_sort_counters;
+    }
+
+    perf::counters const& write_counters() const {
+        return m_write_counters;
+    }
+
 private:
     tmp::data& m_tmp_data;
-    semi_sync_queue<counting_step::block_type> m_buffer;
+    channel<counting_step::block_type> m_buffer;
     std::thread m_thread;
     filename_generator m_filename_gen;
     double m_O_time;
     double m_CPU_time;
     uint64_t m_num_flushes;
+    uint8_t m_order;
+    bool m_in_memory;
+    uint64_t m_memory_budget;
+    uint64_t m_retained_bytes;
+    perf::counters m_sort_counters;
+    perf::counters m_write_counters;
     BlockWriter m_writer;
     Comparator m_comparator;
+    std::vector<uint8_t> m_scratch;  // two records, see merge_iterator
+
+    /*
+        Enumerates the sorted N-grams of a block merged with its sorted
+        singletons: an N-gram that is in both was seen once as a singleton,
+        then counted in the hash table. The records that are not the
+        block's own are built in the two scratch records in turn, so that
+        a record stays valid while the next one is read: the writers
+        compare consecutive records.
+    */
+    struct merge_iterator {
+        typedef typename counting_step::block_type::enumerator block_iterator;
+        typedef std::vector<ngram_pointer>::const_iterator singleton_iterator;
+
+        merge_iterator(block_iterator it, block_iterator end,
+                       singleton_iterator s, singleton_iterator s_end,
+                       Comparator const& comparator, uint8_t order,
+                       uint8_t* scratch)
+            : m_it(it)
+            , m_end(end)
+            , m_s(s)
+            , m_s_end(s_end)
+            , m_comparator(comparator)
+            , m_order(order)
+            , m_scratch(scratch)
+            , m_turn(0) {
+            read();
+        }
+
+        bool operator!=(merge_iterator& rhs) {
+            return m_it != rhs.m_it or m_s != rhs.m_s;
+        }
+
+        void operator++() {
+            if (m_in_block) ++m_it;
+            if (m_in_singletons) ++m_s;
+            read();
+        }
+
+        ngram_pointer operator*() const {
+            return m_record;
+        }
+
+    private:
+        block_iterator m_it, m_end;
+        singleton_iterator m_s, m_s_end;
+        Comparator const& m_comparator;
+        uint8_t m_order;
+        uint8_t* m_scratch;
+        uint8_t m_turn;
+        bool m_in_block, m_in_singletons;
+        ngram_pointer m_record;
+
+        void read() {
+            m_in_block = m_it != m_end;
+            m_in_singletons = m_s != m_s_end;
+            if (m_in_block and m_in_singletons) {
+                if (m_comparator(*m_it, *m_s)) {
+                    m_in_singletons = false;
+                } else if (m_comparator(*m_s, *m_it)) {
+                    m_in_block = false;
+                }
+            }
+            if (!m_in_singletons) {
+                if (m_in_block) m_record = *m_it;
+                return;
+            }
+            m_turn ^= 1;
+            m_record.data = reinterpret_cast<word_id*>(
+                m_scratch + m_turn * ngrams_block::record_size(m_order));
+            std::copy(m_s->data, m_s->data + m_order, m_record.data);
+            *(m_record.value(m_order)) =
+                m_in_block ? *((*m_it).value(m_order)) + 1 : 1;
+        }
+    };
 
     void run() {
-        while (m_buffer.active()) flush();
+        try {
+            while (auto* block = m_buffer.front()) {
+                flush(*block);
+                m_buffer.pop();
+            }
+        } catch (...) {  // rethrown on the producer thread
+            m_buffer.fail(std::current_exception());
+        }
     }
 
-    void flush() {
-        m_buffer.lock();
-        if (m_buffer.empty()) {
-            m_buffer.unlock();
+    void flush(counting_step::block_type& block) {
+        if (cancellation::requested()) {  // drop, do not write
+            block.release();
             return;
         }
-        auto& block = m_buffer.pick();
-        m_buffer.unlock();
 
         block.statistics().max_word_id = m_tmp_data.word_ids.size();
 
         auto start = clock_type::now();
-        block.sort(m_comparator);
+        {
+            perf::scope sort(m_sort_counters);
+            block.sort(m_comparator);
+        }
         auto end = clock_type::now();
         std::chrono::duration<double> elapsed = end - start;
         m_CPU_time += elapsed.count();
         std::cerr << "sorting took " << elapsed.count() << " [sec]"
                   << std::endl;
 
-        start = clock_type::now();
-        std::string filename = m_filename_gen();
-        std::ofstream os(filename.c_str(), std::ofstream::binary |
-                                               std::ofstream::ate |
-                                               std::ofstream::app);
-
-        m_writer.write_block(os, block.begin(), block.end(), block.size(),
-                             block.statistics());
-
-        os.close();
-        end = clock_type::now();
-        elapsed = end - start;
-        m_O_time += elapsed.count();
+        if (block.num_singletons()) {
+            reconcile(block);
+        } else {
+            uint64_t bytes =
+                block.size() *
+                (ngrams_block::record_size(m_order) + sizeof(ngram_pointer));
+            if (m_in_memory and m_retained_bytes + bytes <= m_memory_budget) {
+                retain(block);
+                m_retained_bytes += bytes;
+            } else {
+                if (m_in_memory) spill();
+                write_run(block.begin(), block.end(), block.size(),
+                          block.statistics());
+            }
+        }
 
         block.release();
 
-        m_buffer.lock();
-        m_buffer.pop();
-        m_buffer.unlock();
         ++m_num_flushes;
+    }
+
+    // keep a compact copy of the sorted block
+    void retain(counting_step::block_type& block) {
+        if (block.empty()) return;
+        auto start = clock_type::now();
+        ngrams_block run(m_order);
+        run.resize_memory(block.size());
+        run.reserve_index(block.size());
+        for (auto it = block.begin(); it != block.end(); ++it) {
+            auto ptr = *it;
+            run.push_back(ptr.data, ptr.data + m_order, *(ptr.value(m_order)));
+        }
+        run.stats = block.statistics();
+        m_tmp_data.counts_blocks.push_back(std::move(run));
+        auto end = clock_type::now();
+        std::chrono::duration<double> elapsed = end - start;
+        m_CPU_time += elapsed.count();
+    }
+
+    /*
+        Sort the singletons of the block and merge them with its sorted
+        N-grams into a run, written or retained like a plain block. The
+        merge is run once more beforehand, for the size and the largest
+        count of the run: no copy of the block is made to be written.
+    */
+    void reconcile(counting_step::block_type& block) {
+        auto start = clock_type::now();
+        std::vector<ngram_pointer> singletons(block.num_singletons());
+        for (uint64_t i = 0; i != singletons.size(); ++i) {
+            singletons[i].data = block.singleton(i);
+        }
+        {
+            perf::scope sort(m_sort_counters);
+#ifdef __APPLE__
+            std::sort
+#else
+            __gnu_parallel::sort
+#endif
+                (singletons.begin(), singletons.end(),
+                 [&](auto l, auto r) { return m_comparator(l, r); });
+        }
+
+        auto merge_begin = [&]() {
+            return merge_iterator(block.begin(), block.end(),
+                                  singletons.begin(), singletons.end(),
+                                  m_comparator, m_order, m_scratch.data());
+        };
+        merge_iterator merge_end(block.end(), block.end(), singletons.end(),
+                                 singletons.end(), m_comparator, m_order,
+                                 m_scratch.data());
+        uint64_t n = 0;
+        ngrams_block_statistics stats = block.statistics();
+        for (auto it = merge_begin(); it != merge_end; ++it, ++n) {
+            count_type count = *((*it).value(m_order));
+            if (count > stats.max_count) stats.max_count = count;
+        }
+
+        auto end = clock_type::now();
+        std::chrono::duration<double> elapsed = end - start;
+        m_CPU_time += elapsed.count();
+        std::cerr << "merging " << singletons.size() << " singletons took "
+                  << elapsed.count() << " [sec]" << std::endl;
+
+        uint64_t bytes =
+            n * (ngrams_block::record_size(m_order) + sizeof(ngram_pointer));
+        if (m_in_memory and m_retained_bytes + bytes <= m_memory_budget) {
+            start = clock_type::now();
+            ngrams_block run(m_order);
+            run.resize_memory(n);
+            run.reserve_index(n);
+            for (auto it = merge_begin(); it != merge_end; ++it) {
+                auto ptr = *it;
+                run.push_back(ptr.data, ptr.data + m_order,
+                              *(ptr.value(m_order)));
+            }
+            run.stats = stats;
+            m_tmp_data.counts_blocks.push_back(std::move(run));
+            m_retained_bytes += bytes;
+            end = clock_type::now();
+            elapsed = end - start;
+            m_CPU_time += elapsed.count();
+        } else {
+            if (m_in_memory) spill();
+            write_run(merge_begin(), merge_end, n, stats);
+        }
+    }
+
+    // the runs do not all fit in memory: write those retained so far
+    void spill() {
+        m_in_memory = false;
+        for (auto& run : m_tmp_data.counts_blocks) {
+            write_run(run.begin(), run.end(), run.size(), run.stats);
+            run.release();
+        }
+        m_tmp_data.counts_blocks.clear();
+        m_retained_bytes = 0;
+    }
+
+    template <typename Iterator>
+    void write_run(Iterator begin, Iterator end, size_t n,
+                   ngrams_block_statistics const& stats) {
+        auto start = clock_type::now();
+        {
+            perf::scope write(m_write_counters);
+            std::string filename = m_filename_gen();
+            tmp_files::created(filename);
+            // exact size if uncompressed; compressed runs are not reserved
+            // at the (much larger) uncompressed size
+            uint64_t size = std::is_same<BlockWriter, stream::writer>::value
+                                ? n * ngrams_block::record_size(m_order)
+                                : 0;
+            preallocated_ofstream os(filename, size, m_tmp_data.tmp_usage);
+
+            m_writer.write_block(os, begin, end, n, stats);
+
+            os.close();
+            if (!os) {
+                throw std::runtime_error("cannot write file '" + filename +
+                                         "': " + std::strerror(errno));
+            }
+            m_tmp_data.num_run_ngrams += n;
+            m_tmp_data.run_filenames.push_back(filename);
+        }
+        auto end_time = clock_type::now();
+        std::chrono::duration<double> elapsed = end_time - start;
+        m_O_time += elapsed.count();
         m_filename_gen.next();
+        m_tmp_data.progress.add_run();
     }
 };
 
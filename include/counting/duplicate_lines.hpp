@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+
+#include "util_types.hpp"
+#include "hash_utils.hpp"
+
+namespace tongrams {
+
+/*
+    Remembers the lines seen so far, to skip exact duplicates before they
+    are counted. Lines are looked up by their 64-bit hashes and compared
+    byte by byte on a hit, against a copy kept in an arena: the text they
+    come from is unmapped block after block.
+    Memory is bounded: once the table is half full or the arena is, new
+    lines are no longer remembered but are still checked. A line is
+    skipped only if an identical one was counted; the duplicates of lines
+    that did not fit are counted again.
+*/
+struct duplicate_lines {
+    duplicate_lines()
+        : m_mask(0)
+        , m_size(0)
+        , m_full(false)
+        , m_lines(0)
+        , m_duplicates(0)
+        , m_duplicate_bytes(0) {}
+
+    // use at most [bytes] of memory: at most a quarter for the table, the
+    // rest for the arena
+    void init(uint64_t bytes) {
+        uint64_t capacity = 1024;
+        while (2 * capacity * sizeof(slot) <= bytes / 4) capacity *= 2;
+        m_table.assign(capacity, slot());
+        m_mask = capacity - 1;
+        m_size = 0;
+        m_full = false;
+        uint64_t table_bytes = capacity * sizeof(slot);
+        m_arena.clear();
+        m_arena.reserve(bytes > table_bytes ? bytes - table_bytes : 0);
+    }
+
+    // true if [line] was seen before; otherwise remember it, if there is
+    // room left
+    bool seen(byte_range line) {
+        ++m_lines;
+        uint64_t length = line.second - line.first;
+        uint64_t hash = hash_utils::byte_range_hash64(line);
+        if (hash == 0) hash = 1;  // 0 marks an empty slot
+        for (uint64_t i = hash & m_mask;; i = (i + 1) & m_mask) {
+            slot const& s = m_table[i];
+            if (s.hash == hash and s.length == length and
+                std::equal(line.first, line.second,
+                           m_arena.data() + s.offset)) {
+                ++m_duplicates;
+                m_duplicate_bytes += length + 1;
+                return true;
+            }
+            if (s.hash == 0) {
+                if (m_size < m_table.size() / 2 and
+                    length <= m_arena.capacity() - m_arena.size()) {
+                    m_table[i] = {hash, m_arena.size(), length};
+                    m_arena.insert(m_arena.end(), line.first, line.second);
+                    ++m_size;
+                } else {
+                    m_full = true;
+                }
+                return false;
+            }
+        }
+    }
+
+    // true if some line could not be remembered
+    bool full() const {
+        return m_full;
+    }
+
+    void print_stats() const {
+        std::cout << "\"lines\":" << m_lines << ", ";
+        std::cout << "\"duplicate_lines\":" << m_duplicates << ", ";
+        std::cout << "\"duplicate_bytes\":" << m_duplicate_bytes << ", ";
+        std::cout << "\"dedup_table_full\":" << (full() ? "true" : "false")
+                  << ", ";
+    }
+
+private:
+    struct slot {
+        uint64_t hash = 0;
+        uint64_t offset = 0;  // of the line in the arena
+        uint64_t length = 0;
+    };
+
+    std::vector<slot> m_table;
+    std::vector<uint8_t> m_arena;  // never grows past its reserved capacity
+    uint64_t m_mask;
+    uint64_t m_size;
+    bool m_full;
+    uint64_t m_lines;
+    uint64_t m_duplicates;
+    uint64_t m_duplicate_bytes;
+};
+
+}  // namespace tongrams
@@ -32,6 +32,25 @@ struct ngrams_hash_block {
         m_block.resize_index(size);
     }
 
+    // N-grams seen only once so far, stored as bare words, without count
+    // nor hash slot: see counting_reader
+    void reserve_singletons(uint64_t size) {
+        m_singletons.reserve(size * order());
+    }
+
+    void push_singleton(word_id const* ngram) {
+        m_singletons.insert(m_singletons.end(), ngram, ngram + order());
+    }
+
+    uint64_t num_singletons() const {
+        return m_num_bytes ? m_singletons.size() / order() : 0;
+    }
+
+    word_id* singleton(uint64_t i) {
+        assert(i < num_singletons());
+        return m_singletons.data() + i * order();
+    }
+
     std::pair<bool, ngram_id> find_or_insert(ngram_type const& key,
                                              iterator hint) {
         assert(buckets());
@@ -151,6 +170,7 @@ struct ngrams_hash_block {
         std::swap(m_num_bytes, other.m_num_bytes);
         m_data.swap(other.m_data);
         m_block.swap(other.m_block);
+        m_singletons.swap(other.m_singletons);
     }
 
     void release_hash_index() {
@@ -170,6 +190,11 @@ private:
     size_t m_num_bytes;
     std::vector<ngram_id> m_data;
     ngrams_block m_block;
+    std::vector<word_id> m_singletons;
+
+    uint64_t order() const {
+        return m_num_bytes / sizeof(word_id);
+    }
 };
 
 }  // namespace tongrams
@@ -12,12 +12,25 @@ namespace tongrams {
 
 struct sliding_window {
     sliding_window(uint8_t capacity)
-        : m_end(2), m_buff(capacity), m_time(0.0) {}
+        : m_end(2)
+        , m_text_end(nullptr)
+        , m_begins_line(false)
+        , m_after_newline(true)
+        , m_buff(capacity)
+        , m_time(0.0) {}
 
     void init(byte_range text, uint64_t pos = 2) {
+        seek(text, pos);
+        m_time = 0.0;
+    }
+
+    // continue with [text], which begins a line at position [pos], keeping
+    // the words in the window
+    void seek(byte_range text, uint64_t pos) {
         m_end = pos;
+        m_text_end = text.second;
+        m_after_newline = true;
         m_iterator.init(text);
-        m_time = 0.0;
     }
 
     void fill(word_id id) {
@@ -49,10 +62,10 @@ struct sliding_window {
     bool advance() {
         if (!m_iterator.has_next()) return false;
 
-        shift();
         uint64_t hash = hash_utils::hash_empty_token;
         byte_range range = constants::empty_token_byte_range;
         size_t range_len = 0;
+        bool new_line = m_after_newline;
 
         while (range_len == 0) {  // skip blank lines
             if (m_iterator.has_next()) {
@@ -62,6 +75,7 @@ struct sliding_window {
                 std::chrono::duration<double> elapsed = end - start;
                 m_time += elapsed.count();
                 range_len = range.second - range.first;
+                if (range_len == 0 and ends_line(range)) new_line = true;
             } else {
                 m_end += 2;
                 m_last.init(hash, range);
@@ -69,14 +83,24 @@ struct sliding_window {
             }
         }
 
+        // shift only when there is a word to eat: shifting before blank
+        // ranges that end the text would repeat the last word in the window
+        shift();
         ++range_len;
         hash = hash_utils::byte_range_hash64(range);
         m_end += range_len;
         m_last.init(hash, range);
+        m_begins_line = new_line;
+        m_after_newline = ends_line(range);
 
         return true;
     }
 
+    // whether the last word is the first of its line
+    bool begins_line() const {
+        return m_begins_line;
+    }
+
     void eat(word_id id) {
         m_buff.back() = id;
     }
@@ -105,8 +129,21 @@ struct sliding_window {
         return m_time;
     }
 
+    // beginning of next word in the text
+    uint64_t position() const {
+        return m_end;
+    }
+
 private:
+    // the separator that ends a word is the byte after it
+    bool ends_line(byte_range range) const {
+        return range.second != m_text_end and *range.second == '\n';
+    }
+
     uint64_t m_end;  // beginning of next word
+    uint8_t const* m_text_end;
+    bool m_begins_line;
+    bool m_after_newline;  // a newline follows the last word
     word m_last;
     forward_byte_range_iterator m_iterator;
     ngram_type m_buff;
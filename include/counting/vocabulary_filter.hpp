@@ -0,0 +1,192 @@
+#pragma once
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <mutex>
+#include <sparsehash/dense_hash_set>
+
+#include "configuration.hpp"
+#include "util.hpp"
+#include "util_types.hpp"
+#include "hash_utils.hpp"
+
+namespace tongrams {
+
+/*
+    Restricts the vocabulary to the words that occur at least
+    [min_unigram_count] times and, among them, to the [max_vocab] most
+    frequent ones: counting maps all the other words to <unk>.
+    The unigram counts come from a pre-pass over the text, split among
+    [num_threads] threads. Each thread counts the words of its range into a
+    local map of bounded size, which it merges into shared shards whenever
+    it fills up: shard i holds the words whose hash is i modulo the number
+    of threads, so that each word is held once. The local maps take half of
+    the RAM at most; the shards, a copy of the whole vocabulary, should fit
+    in the other half. Only the hashes of the kept words survive the
+    pre-pass.
+*/
+struct vocabulary_filter {
+    vocabulary_filter()
+        : m_enabled(false), m_distinct_words(0), m_unk_tokens(0), m_time(0.0) {
+        m_kept.set_empty_key(constants::invalid_hash);
+    }
+
+    void build(configuration const& config) {
+        m_enabled = config.max_vocab or config.min_unigram_count > 1;
+        if (!m_enabled) return;
+
+        auto start = clock_type::now();
+        boost::iostreams::mapped_file_source file;
+        file.open(config.text_filename);
+        util::check_file(file);
+        auto data = reinterpret_cast<uint8_t const*>(file.data());
+        util::optimize_sequential_access(data, file.size());
+
+        // ranges that begin and end at word boundaries
+        uint64_t num_threads =
+            std::max<uint64_t>(1, std::min<uint64_t>(config.num_threads,
+                                                     file.size() / 1024));
+        std::vector<byte_range> ranges;
+        uint8_t const* begin = data;
+        uint8_t const* text_end = data + file.size();
+        for (uint64_t i = 1; i <= num_threads; ++i) {
+            uint8_t const* end = std::max(begin, data + file.size() * i /
+                                                            num_threads);
+            while (end != text_end and *end != ' ' and *end != '\n') ++end;
+            ranges.emplace_back(begin, end);
+            begin = end;
+        }
+
+        shards shared(ranges.size());
+        uint64_t max_local_words =
+            std::max<uint64_t>(1024, config.RAM / 2 / ranges.size() /
+                                         bytes_per_word);
+        {
+            parallel_executor p(ranges.size());
+            task_region(*(p.executor), [&](task_region_handle& trh) {
+                for (uint64_t i = 0; i != ranges.size(); ++i) {
+                    trh.run([&, i] {
+                        count(ranges[i], i, max_local_words, shared);
+                    });
+                }
+            });
+        }
+
+        uint64_t shards_bytes = 0;
+        m_distinct_words = 0;
+        for (auto const& shard : shared.counts) {
+            shards_bytes += shard.bucket_count() *
+                            sizeof(std::pair<uint64_t, uint64_t>);
+            m_distinct_words += shard.size();
+        }
+        if (shards_bytes > config.RAM / 2) {
+            std::cerr << "Warning: the unigram counts of the vocabulary "
+                         "pre-pass take "
+                      << shards_bytes << " bytes, more than half of the RAM"
+                      << std::endl;
+        }
+
+        std::vector<std::pair<uint64_t, uint64_t>> words;  // count, hash
+        for (auto& shard : shared.counts) {
+            for (auto const& x : shard) {
+                if (x.second >= config.min_unigram_count) {
+                    words.emplace_back(x.second, x.first);
+                }
+            }
+            unigram_counts().swap(shard);
+        }
+
+        if (config.max_vocab and words.size() > config.max_vocab) {
+            // most frequent first; ties are broken by hash, to be
+            // deterministic
+            std::nth_element(
+                words.begin(), words.begin() + config.max_vocab, words.end(),
+                std::greater<std::pair<uint64_t, uint64_t>>());
+            words.resize(config.max_vocab);
+        }
+        m_kept.resize(words.size());
+        for (auto const& w : words) m_kept.insert(w.second);
+
+        auto end = clock_type::now();
+        std::chrono::duration<double> elapsed = end - start;
+        m_time = elapsed.count();
+        std::cerr << "vocabulary: kept " << m_kept.size() << " words out of "
+                  << m_distinct_words << " in " << m_time << " [sec]"
+                  << std::endl;
+    }
+
+    bool enabled() const {
+        return m_enabled;
+    }
+
+    // whether a word with this hash keeps its own id
+    bool keeps(uint64_t hash) {
+        if (!m_enabled or m_kept.find(hash) != m_kept.end()) return true;
+        ++m_unk_tokens;
+        return false;
+    }
+
+    void print_stats() const {
+        std::cout << "\"distinct_words\":" << m_distinct_words << ", ";
+        std::cout << "\"kept_words\":" << m_kept.size() << ", ";
+        std::cout << "\"unk_tokens\":" << m_unk_tokens << ", ";
+        std::cout << "\"vocabulary_pre_pass\":" << m_time << ", ";
+    }
+
+private:
+    typedef google::dense_hash_map<uint64_t, uint64_t> unigram_counts;
+
+    // hash table of at most half load, which doubles when full
+    static constexpr uint64_t bytes_per_word =
+        4 * sizeof(std::pair<uint64_t, uint64_t>);
+
+    struct shards {
+        shards(uint64_t n) : counts(n), locks(n) {
+            for (auto& c : counts) c.set_empty_key(constants::invalid_hash);
+        }
+        std::vector<unigram_counts> counts;
+        std::vector<std::mutex> locks;
+    };
+
+    bool m_enabled;
+    uint64_t m_distinct_words;
+    uint64_t m_unk_tokens;
+    double m_time;
+    google::dense_hash_set<uint64_t> m_kept;
+
+    // count the words of [text] on thread [id] of [shared]
+    static void count(byte_range text, uint64_t id, uint64_t max_local_words,
+                      shards& shared) {
+        unigram_counts counts;
+        counts.set_empty_key(constants::invalid_hash);
+        auto add = [&](byte_range word) {
+            ++counts[hash_utils::byte_range_hash64(word)];
+            if (counts.size() == max_local_words) merge(counts, id, shared);
+        };
+        uint8_t const* word = text.first;
+        for (uint8_t const* p = text.first; p != text.second; ++p) {
+            if (*p == ' ' or *p == '\n') {
+                if (p != word) add({word, p});
+                word = p + 1;
+            }
+        }
+        if (word != text.second) add({word, text.second});
+        merge(counts, id, shared);
+    }
+
+    // add [counts] to the shards, each locked once, then clear it; thread
+    // [id] begins with shard [id], so that threads seldom wait for a lock
+    static void merge(unigram_counts& counts, uint64_t id, shards& shared) {
+        uint64_t n = shared.counts.size();
+        for (uint64_t j = 0; j != n; ++j) {
+            uint64_t i = (id + j) % n;
+            std::lock_guard<std::mutex> lock(shared.locks[i]);
+            auto& shard = shared.counts[i];
+            for (auto const& x : counts) {
+                if (x.first % n == i) shard[x.first] += x.second;
+            }
+        }
+        counts.clear();
+    }
+};
+
+}  // namespace tongrams
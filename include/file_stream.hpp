@@ -0,0 +1,524 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "util.hpp"
+#include "util_types.hpp"
+#include "tmp_usage.hpp"
+
+namespace tongrams {
+
+/*
+    Reserve [size] bytes of disk for the file open with [fd], without
+    changing its size, so that the file system can lay it out in few
+    extents. Returns the bytes reserved: 0 if the file system cannot
+    reserve space (then blocks are allocated as they are written).
+    Unlike posix_fallocate, this never falls back to writing zeros.
+*/
+uint64_t reserve_space(int fd, uint64_t size) {
+    if (size == 0) return 0;
+    if (::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0) return size;
+    if (errno != EOPNOTSUPP) {  // e.g., ENOSPC: give back what was taken
+        int r = ::ftruncate(fd, 0);
+        (void)r;
+    }
+    return 0;
+}
+
+/*
+    Output stream for temporary files whose size is known (or bounded) in
+    advance. The space is reserved when the file is opened, and the file
+    is written through a large buffer, so that all writes but the last are
+    of the same aligned size. On close, the reserved space not written is
+    given back.
+    The bytes taken on disk, reserved or written, are counted in the given
+    tmp_space_usage.
+*/
+struct preallocated_ofstream : std::ostream {
+    static constexpr size_t buffer_bytes = 8 * essentials::MiB;
+
+    preallocated_ofstream() : std::ostream(&m_buf) {}
+
+    preallocated_ofstream(std::string const& filename, uint64_t size,
+                          tmp_space_usage& usage)
+        : std::ostream(&m_buf) {
+        open(filename, size, usage);
+    }
+
+    ~preallocated_ofstream() {
+        close();
+    }
+
+    void open(std::string const& filename, uint64_t size,
+              tmp_space_usage& usage) {
+        if (!m_buf.open(filename, size, usage)) {
+            throw std::runtime_error("cannot open file '" + filename +
+                                     "': " + std::strerror(errno));
+        }
+        clear();
+    }
+
+    bool is_open() const {
+        return m_buf.is_open();
+    }
+
+    void close() {
+        if (!m_buf.close()) setstate(std::ios_base::badbit);
+    }
+
+private:
+    struct file_buffer : std::streambuf {
+        file_buffer()
+            : m_fd(-1)
+            , m_written(0)
+            , m_reserved(0)
+            , m_counted(0)
+            , m_usage(nullptr) {}
+
+        bool is_open() const {
+            return m_fd != -1;
+        }
+
+        bool open(std::string const& filename, uint64_t size,
+                  tmp_space_usage& usage) {
+            m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (m_fd == -1) return false;
+            m_written = 0;
+            m_usage = &usage;
+            m_reserved = reserve_space(m_fd, size);
+            m_counted = m_reserved;
+            m_usage->add(m_counted);
+            m_buffer.resize(buffer_bytes);
+            setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+            return true;
+        }
+
+        bool close() {
+            if (!is_open()) return true;
+            bool ok = flush();
+            if (m_written < m_reserved) {
+                // free the blocks reserved past the end of the file
+                ok = ::ftruncate(m_fd, m_written) == 0 and ok;
+            }
+            ok = ::close(m_fd) == 0 and ok;
+            m_fd = -1;
+            m_usage->sub(m_counted - m_written);
+            m_counted = m_written;
+            std::vector<char>().swap(m_buffer);
+            setp(nullptr, nullptr);
+            return ok;
+        }
+
+    protected:
+        int overflow(int c) override {
+            if (!flush()) return traits_type::eof();
+            if (c != traits_type::eof()) {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(char const* s, std::streamsize n) override {
+            std::streamsize left = n;
+            while (left > 0) {
+                if (pptr() == epptr() and !flush()) return n - left;
+                std::streamsize chunk =
+                    std::min<std::streamsize>(left, epptr() - pptr());
+                std::memcpy(pptr(), s, chunk);
+                pbump(static_cast<int>(chunk));
+                s += chunk;
+                left -= chunk;
+            }
+            return n;
+        }
+
+        int sync() override {
+            return flush() ? 0 : -1;
+        }
+
+    private:
+        int m_fd;
+        uint64_t m_written;
+        uint64_t m_reserved;
+        uint64_t m_counted;  // in m_usage: max(m_reserved, m_written)
+        tmp_space_usage* m_usage;
+        std::vector<char> m_buffer;
+
+        bool flush() {
+            char const* begin = pbase();
+            size_t bytes = pptr() - pbase();
+            while (bytes) {
+                ssize_t w = ::write(m_fd, begin, bytes);
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                begin += w;
+                bytes -= w;
+                m_written += w;
+            }
+            if (m_written > m_counted) {
+                m_usage->add(m_written - m_counted);
+                m_counted = m_written;
+            }
+            setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+            return true;
+        }
+    };
+
+    file_buffer m_buf;
+};
+
+/*
+    Output file written by a pool of threads: the bytes streamed in are
+    gathered in large buffers, each written with pwrite at its own offset
+    as soon as it is full, so that serializing the data and writing it
+    proceed together and several writes are in flight at the same time.
+*/
+struct parallel_ofstream : std::ostream {
+    static constexpr size_t buffer_bytes = 8 * essentials::MiB;
+    static constexpr uint64_t max_writers = 8;
+
+    parallel_ofstream(std::string const& filename, uint64_t size,
+                      uint64_t num_writers)
+        : std::ostream(&m_buf) {
+        if (!m_buf.open(filename, size, num_writers)) {
+            throw std::runtime_error("cannot open file '" + filename +
+                                     "': " + std::strerror(errno));
+        }
+    }
+
+    ~parallel_ofstream() {
+        close();
+    }
+
+    void close() {
+        if (!m_buf.close()) setstate(std::ios_base::badbit);
+    }
+
+private:
+    struct file_buffer : std::streambuf {
+        file_buffer()
+            : m_fd(-1)
+            , m_offset(0)
+            , m_reserved(0)
+            , m_max_in_flight(0)
+            , m_in_flight(0)
+            , m_failed(false)
+            , m_stop(false) {}
+
+        bool open(std::string const& filename, uint64_t size,
+                  uint64_t num_writers) {
+            m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (m_fd == -1) return false;
+            m_reserved = reserve_space(m_fd, size);
+            num_writers = std::max<uint64_t>(
+                1, std::min<uint64_t>(num_writers, max_writers));
+            m_max_in_flight = 2 * num_writers;
+            for (uint64_t i = 0; i != num_writers; ++i) {
+                m_writers.emplace_back(&file_buffer::run, this);
+            }
+            next_buffer();
+            return true;
+        }
+
+        bool close() {
+            if (m_fd == -1) return true;
+            submit();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_work.notify_all();
+            for (auto& t : m_writers) t.join();
+            m_writers.clear();
+            bool ok = !m_failed;
+            if (m_offset < m_reserved) {
+                ok = ::ftruncate(m_fd, m_offset) == 0 and ok;
+            }
+            ok = ::close(m_fd) == 0 and ok;
+            m_fd = -1;
+            std::vector<char>().swap(m_buffer);
+            m_free.clear();
+            setp(nullptr, nullptr);
+            return ok;
+        }
+
+    protected:
+        int overflow(int c) override {
+            submit();
+            if (m_failed) return traits_type::eof();
+            if (c != traits_type::eof()) {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(char const* s, std::streamsize n) override {
+            std::streamsize left = n;
+            while (left > 0) {
+                if (pptr() == epptr()) submit();
+                if (m_failed) return n - left;
+                std::streamsize chunk =
+                    std::min<std::streamsize>(left, epptr() - pptr());
+                std::memcpy(pptr(), s, chunk);
+                pbump(static_cast<int>(chunk));
+                s += chunk;
+                left -= chunk;
+            }
+            return n;
+        }
+
+    private:
+        struct job {
+            std::vector<char> data;
+            size_t bytes;
+            uint64_t offset;
+        };
+
+        int m_fd;
+        uint64_t m_offset;  // of the current buffer
+        uint64_t m_reserved;
+        uint64_t m_max_in_flight;
+        uint64_t m_in_flight;
+        std::atomic<bool> m_failed;
+        bool m_stop;
+
+        std::vector<char> m_buffer;
+        std::deque<job> m_jobs;
+        std::deque<std::vector<char>> m_free;
+        std::mutex m_mutex;
+        std::condition_variable m_work;
+        std::condition_variable m_done;
+        std::vector<std::thread> m_writers;
+
+        void next_buffer() {
+            if (!m_free.empty()) {
+                m_buffer.swap(m_free.front());
+                m_free.pop_front();
+            }
+            m_buffer.resize(buffer_bytes);
+            setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+        }
+
+        // hand the current buffer over to the writers
+        void submit() {
+            size_t bytes = pptr() - pbase();
+            if (bytes == 0) return;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_done.wait(lock,
+                            [&] { return m_in_flight < m_max_in_flight; });
+                m_jobs.push_back({std::move(m_buffer), bytes, m_offset});
+                ++m_in_flight;
+                m_buffer = std::vector<char>();
+                next_buffer();
+            }
+            m_offset += bytes;
+            m_work.notify_one();
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true) {
+                m_work.wait(lock, [&] { return m_stop or !m_jobs.empty(); });
+                if (m_jobs.empty()) return;  // stopped and nothing left
+                job j = std::move(m_jobs.front());
+                m_jobs.pop_front();
+                lock.unlock();
+
+                char const* begin = j.data.data();
+                size_t bytes = j.bytes;
+                uint64_t offset = j.offset;
+                while (bytes and !m_failed) {
+                    ssize_t w = ::pwrite(m_fd, begin, bytes, offset);
+                    if (w < 0) {
+                        if (errno == EINTR) continue;
+                        m_failed = true;
+                        break;
+                    }
+                    begin += w;
+                    bytes -= w;
+                    offset += w;
+                }
+
+                lock.lock();
+                m_free.push_back(std::move(j.data));
+                --m_in_flight;
+                m_done.notify_all();
+            }
+        }
+    };
+
+    file_buffer m_buf;
+};
+
+/*
+    Stream buffer that only counts the bytes written to it: used to know
+    the size of a serialization before writing it.
+*/
+struct byte_counter : std::streambuf {
+    byte_counter() : m_bytes(0) {}
+
+    uint64_t bytes() const {
+        return m_bytes;
+    }
+
+protected:
+    int overflow(int c) override {
+        if (c != traits_type::eof()) ++m_bytes;
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(char const*, std::streamsize n) override {
+        m_bytes += n;
+        return n;
+    }
+
+private:
+    uint64_t m_bytes;
+};
+
+/*
+    Visitor serializing a data structure to any output stream, in the same
+    format as essentials::saver.
+*/
+struct stream_saver {
+    stream_saver(std::ostream& os) : m_os(os) {}
+
+    template <typename T>
+    void visit(T& val) {
+        if constexpr (is_pod<T>()) {
+            essentials::save_pod(m_os, val);
+        } else {
+            val.visit(*this);
+        }
+    }
+
+    // vectors of PODs are written in one go, the others element by element
+    template <typename T, typename Allocator>
+    void visit(std::vector<T, Allocator>& vec) {
+        if constexpr (is_pod<T>()) {
+            essentials::save_vec(m_os, vec);
+        } else {
+            size_t n = vec.size();
+            visit(n);
+            for (auto& v : vec) visit(v);
+        }
+    }
+
+private:
+    std::ostream& m_os;
+
+    template <typename T>
+    static constexpr bool is_pod() {
+        return std::is_trivial<T>::value and std::is_standard_layout<T>::value;
+    }
+};
+
+/*
+    Stream buffer that hashes the bytes written to it (FNV-1a): used to
+    compare two serializations without storing them.
+*/
+struct byte_hasher : std::streambuf {
+    byte_hasher() : m_hash(14695981039346656037ULL), m_bytes(0) {}
+
+    uint64_t hash() const {
+        return m_hash;
+    }
+
+    uint64_t bytes() const {
+        return m_bytes;
+    }
+
+protected:
+    int overflow(int c) override {
+        if (c != traits_type::eof()) {
+            char b = traits_type::to_char_type(c);
+            xsputn(&b, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(char const* s, std::streamsize n) override {
+        for (std::streamsize i = 0; i != n; ++i) {
+            m_hash ^= static_cast<uint8_t>(s[i]);
+            m_hash *= 1099511628211ULL;
+        }
+        m_bytes += n;
+        return n;
+    }
+
+private:
+    uint64_t m_hash;
+    uint64_t m_bytes;
+};
+
+/*
+    Same file as util::save, but the size is computed beforehand, to
+    preallocate the file, and the bytes are written by [num_writers]
+    threads. Returns the number of bytes written.
+*/
+template <typename T>
+uint64_t parallel_save(uint64_t header, T& data_structure,
+                       std::string const& filename, uint64_t num_writers) {
+    byte_counter counter;
+    {
+        std::ostream os(&counter);
+        stream_saver saver(os);
+        saver.visit(header);
+        saver.visit(data_structure);
+    }
+    parallel_ofstream os(filename, counter.bytes(), num_writers);
+    stream_saver saver(os);
+    saver.visit(header);
+    saver.visit(data_structure);
+    os.close();
+    if (!os) {
+        throw std::runtime_error("cannot write file '" + filename +
+                                 "': " + std::strerror(errno));
+    }
+    return counter.bytes();
+}
+
+/*
+    Round-trip check of parallel_save: the file, loaded back with
+    util::load, must serialize to the same bytes as [data_structure].
+*/
+template <typename T>
+void check_saved(uint64_t header, T& data_structure,
+                 std::string const& filename) {
+    auto digest = [&](T& ds) {
+        byte_hasher hasher;
+        std::ostream os(&hasher);
+        stream_saver saver(os);
+        saver.visit(header);
+        saver.visit(ds);
+        return std::make_pair(hasher.bytes(), hasher.hash());
+    };
+    T loaded;
+    util::load(loaded, filename);
+    if (digest(loaded) != digest(data_structure)) {
+        throw std::runtime_error("file '" + filename +
+                                 "' does not load back as written");
+    }
+}
+
+}  // namespace tongrams
@@ -16,7 +16,7 @@ struct writer {
     writer(uint8_t N) : m_comparator(N) {}
 
     template <typename Iterator>
-    void write_block(std::ofstream& os, Iterator begin, Iterator end, size_t n,
+    void write_block(std::ostream& os, Iterator begin, Iterator end, size_t n,
                      ngrams_block_statistics const& stats) {
         // in bytes
         uint8_t l = 1;
@@ -55,7 +55,7 @@ struct writer {
             if (BLOCK_BITS - m_buffer.size() < max_record_size) {
                 // flush current buffer, inserting padding
                 // always flush exactly BLOCK_BYTES bytes
-                flush_buffer(os, BLOCK_BYTES, num_ngrams_in_block);
+                flush_buffer(os, BLOCK_BYTES, num_ngrams_in_block, prev_ptr);
                 m_buffer.init();
                 m_buffer.reserve(BLOCK_BITS);
                 written = encoded;
@@ -84,7 +84,7 @@ struct writer {
         // save last block if needed
         if (written != n) {
             size_t bytes = (m_buffer.size() + 7) / 8;
-            flush_buffer(os, bytes, num_ngrams_in_block);
+            flush_buffer(os, bytes, num_ngrams_in_block, prev_ptr);
         }
     }
 
@@ -93,10 +93,14 @@ private:
     bit_vector_builder m_buffer;  // NOTE: need a buffer beacuse we do not know
                                   // how many ngrams we can compress in a block
 
-    void flush_buffer(std::ofstream& os, size_t bytes,
-                      uint64_t num_ngrams_in_block) {
+    // a block starts with the number of N-grams it holds and its last
+    // N-gram, uncompressed, so that a reader knows it without decoding
+    void flush_buffer(std::ostream& os, size_t bytes,
+                      uint64_t num_ngrams_in_block, ngram_pointer last) {
         assert(num_ngrams_in_block > 0);
         essentials::save_pod(os, num_ngrams_in_block);
+        os.write(reinterpret_cast<char const*>(last.data),
+                 tongrams::ngrams_block::record_size(m_comparator.order()));
         os.write(reinterpret_cast<char const*>(m_buffer.data().data()), bytes);
     }
 };
@@ -271,6 +275,12 @@ struct ngrams_block {
     ngrams_block(uint8_t N, size_t size, uint8_t w, uint8_t v)
         : m_size(size), m_N(N), m_w(w), m_v(v) {}
 
+    // the last N-gram, stored in the header of the block
+    void read_back(std::ifstream& is) {
+        m_back.resize(tongrams::ngrams_block::record_size(m_N));
+        is.read(reinterpret_cast<char*>(m_back.data()), m_back.size());
+    }
+
     void read(std::ifstream& is, size_t bytes) {
         m_memory.resize(bytes);
         is.read(reinterpret_cast<char*>(m_memory.data()), bytes);
@@ -319,6 +329,7 @@ struct ngrams_block {
 
     void swap(ngrams_block<Comparator>& other) {
         m_memory.swap(other.m_memory);
+        m_back.swap(other.m_back);
         std::swap(m_size, other.m_size);
         std::swap(m_N, other.m_N);
         std::swap(m_w, other.m_w);
@@ -343,8 +354,20 @@ struct ngrams_block {
         return m_size;
     }
 
+    bool empty() const {
+        return m_size == 0;
+    }
+
+    ngram_pointer back() {
+        assert(!m_back.empty());
+        ngram_pointer ptr;
+        ptr.data = reinterpret_cast<word_id*>(m_back.data());
+        return ptr;
+    }
+
 private:
     std::vector<uint8_t> m_memory;
+    std::vector<uint8_t> m_back;
     size_t m_size;
     uint8_t m_N;
     uint8_t m_w, m_v;
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ngrams_block.hpp"
+#include "progress.hpp"
+#include "stream.hpp"
+
+namespace tongrams {
+
+/*
+    Refills the buffers of the runs of a k-way merge with a fixed set of
+    I/O threads.
+    Forecasting: the run whose last buffered N-gram is the smallest is the
+    first the merge will exhaust, so it is the next to be refilled.
+    A run with nothing buffered is always refilled, since the merge cannot
+    progress without it; otherwise a run is refilled only if all runs
+    together do not buffer more than [blocks_per_run] blocks each.
+    Runs kept in memory need no I/O: they are served on the calling thread.
+    A failed read stops the workers and is rethrown by get_block().
+*/
+template <typename StreamGenerator, typename Comparator>
+struct io_scheduler {
+    typedef typename StreamGenerator::block_type block_type;
+    static constexpr uint64_t max_io_workers = 4;
+    static constexpr bool in_memory =
+        std::is_same<StreamGenerator, stream::memory_stream_generator>::value;
+
+    // the block being merged and the one prefetched, on average
+    static constexpr uint64_t blocks_per_run = 2;
+
+    // the load size for which the blocks buffered for [num_runs] runs plus
+    // [num_other_blocks] blocks held by the merge and its stages fit in
+    // [ram] bytes, as a multiple of [record_size]
+    static uint64_t max_load_size(uint64_t ram, uint64_t num_runs,
+                                  uint64_t num_other_blocks,
+                                  uint64_t record_size) {
+        uint64_t num_blocks = blocks_per_run * num_runs + num_other_blocks;
+        return ram / num_blocks / record_size * record_size;
+    }
+
+    io_scheduler(std::deque<StreamGenerator>& generators, uint8_t order,
+                 uint64_t load_size, uint64_t num_workers,
+                 progress_reporter& progress)
+        : m_generators(generators)
+        , m_comparator(order)
+        , m_order(order)
+        , m_load_size(load_size)
+        , m_budget(blocks_per_run * generators.size() * load_size)
+        , m_buffered(0)
+        , m_waiting_time(0.0)
+        , m_num_fetches(0)
+        , m_stop(false)
+        , m_progress(progress) {
+        if constexpr (!in_memory) {
+            m_runs.resize(m_generators.size());
+            for (auto& r : m_runs) r.last.init(order);
+            if (num_workers == 0) num_workers = 1;
+            for (uint64_t i = 0; i != num_workers; ++i) {
+                m_workers.emplace_back(&io_scheduler::run, this);
+            }
+        }
+    }
+
+    ~io_scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_work.notify_all();
+        for (auto& t : m_workers) t.join();
+    }
+
+    // the front block of run k, waiting for it if not yet read
+    block_type* get_block(uint64_t k) {
+        auto& gen = m_generators[k];
+        if constexpr (in_memory) {
+            if (gen.empty()) {
+                size_t read_bytes = gen.read_bytes();
+                gen.fetch_next_block(m_load_size);
+                m_progress.add(gen.read_bytes() - read_bytes);
+            }
+            return gen.get_block();
+        } else {
+            auto& r = m_runs[k];
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (r.blocks.empty()) {
+                auto start = clock_type::now();
+                m_ready.wait(lock,
+                             [&] { return !r.blocks.empty() or m_error; });
+                auto end = clock_type::now();
+                std::chrono::duration<double> elapsed = end - start;
+                m_waiting_time += elapsed.count();
+            }
+            if (m_error) std::rethrow_exception(m_error);
+            return &r.blocks.front();
+        }
+    }
+
+    void release_block(uint64_t k) {
+        if constexpr (in_memory) {
+            m_generators[k].release_block();
+        } else {
+            auto& r = m_runs[k];
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                r.blocks.front().release();
+                r.blocks.pop_front();
+                m_buffered -= r.bytes.front();
+                r.bytes.pop_front();
+            }
+            m_work.notify_all();
+        }
+    }
+
+    // true if run k has been entirely read and consumed
+    bool exhausted(uint64_t k) {
+        auto& gen = m_generators[k];
+        if constexpr (in_memory) {
+            return gen.eos() and gen.empty();
+        } else {
+            auto& r = m_runs[k];
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return r.eos and r.blocks.empty();
+        }
+    }
+
+    // time the merge spent waiting for a block to be read
+    double waiting_time() const {
+        return m_waiting_time;
+    }
+
+    uint64_t num_fetches() const {
+        return m_num_fetches;
+    }
+
+private:
+    static constexpr uint64_t none = uint64_t(-1);
+
+    struct run_state {
+        run_state() : eos(false), in_flight(false) {}
+        std::deque<block_type> blocks;
+        std::deque<uint64_t> bytes;  // read to fill each block
+        ngram_cache last;            // last N-gram buffered, if any
+        bool eos;
+        bool in_flight;  // at most one read per run at a time
+    };
+
+    std::deque<StreamGenerator>& m_generators;
+    Comparator m_comparator;
+    uint8_t m_order;
+    uint64_t m_load_size;
+    uint64_t m_budget;
+    uint64_t m_buffered;
+    double m_waiting_time;
+    uint64_t m_num_fetches;
+    bool m_stop;
+    std::exception_ptr m_error;  // of a read, rethrown by get_block()
+    progress_reporter& m_progress;
+
+    std::vector<run_state> m_runs;
+    std::mutex m_mutex;
+    std::condition_variable m_work;
+    std::condition_variable m_ready;
+    std::vector<std::thread> m_workers;
+
+    // called with the lock held
+    uint64_t next_run() {
+        uint64_t next = none;
+        for (uint64_t k = 0; k != m_runs.size(); ++k) {
+            auto& r = m_runs[k];
+            if (r.eos or r.in_flight) continue;
+            if (r.blocks.empty()) return k;  // the merge needs it
+            if (r.last.empty()) continue;
+            if (next == none or
+                m_comparator.compare(r.last.get(), m_runs[next].last.get()) <
+                    0) {
+                next = k;
+            }
+        }
+        if (next != none and m_buffered + m_load_size > m_budget) return none;
+        return next;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        try {
+            while (true) {
+                uint64_t k = none;
+                m_work.wait(lock, [&] {
+                    if (m_stop) return true;
+                    k = next_run();
+                    return k != none;
+                });
+                if (m_stop) return;
+
+                auto& r = m_runs[k];
+                auto& gen = m_generators[k];
+                r.in_flight = true;
+                m_buffered += m_load_size;  // reserved until the read completes
+                ++m_num_fetches;
+                lock.unlock();
+
+                size_t read_bytes = gen.read_bytes();
+                auto block = gen.read_block(m_load_size);
+                uint64_t bytes = gen.read_bytes() - read_bytes;
+                bool eos = gen.eos();
+                ngram_cache last(m_order);
+                store_last(block, last);
+                m_progress.add(bytes);
+
+                lock.lock();
+                m_buffered -= m_load_size;
+                m_buffered += bytes;
+                r.blocks.push_back(std::move(block));
+                r.bytes.push_back(bytes);
+                r.last.swap(last);
+                r.eos = eos;
+                r.in_flight = false;
+                m_ready.notify_all();
+                m_work.notify_all();
+            }
+        } catch (...) {  // stop all the workers and fail the merge
+            if (!lock.owns_lock()) lock.lock();
+            m_error = std::current_exception();
+            m_stop = true;
+            m_ready.notify_all();
+            m_work.notify_all();
+        }
+    }
+
+    // front-coded blocks keep their last N-gram in the header
+    static void store_last(block_type& block, ngram_cache& last) {
+        if (!block.empty()) last.store(block.back());
+    }
+};
+
+}  // namespace tongrams
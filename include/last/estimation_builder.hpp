@@ -2,6 +2,9 @@
 
 #include "../external/tongrams/include/trie_prob_lm.hpp"
 
+#include "rank_table.hpp"
+#include "scatter_buffer.hpp"
+
 namespace tongrams {
 
 template <typename Vocabulary, typename Mapper, typename Values, typename Ranks,
@@ -15,7 +18,9 @@ struct trie_prob_lm<Vocabulary, Mapper, Values, Ranks, Grams,
         : m_order(order)
         , m_unk_prob(stats.unk_prob())
         , m_arrays(order)
-        , m_next_positions(order, 0) {
+        , m_next_positions(order, 0)
+        , m_probs_ranks(order - 1)
+        , m_backoffs_ranks(order - 2) {
         building_util::check_order(m_order);
 
         uint64_t vocab_size = stats.num_ngrams(1);
@@ -50,6 +55,9 @@ struct trie_prob_lm<Vocabulary, Mapper, Values, Ranks, Grams,
             }
             m_probs.add_sequence(ord - 1, config.probs_quantization_bits,
                                  probs);
+            m_probs_ranks[ord - 2].build([&](float value) {
+                return m_probs.rank(ord - 2, value, 0);
+            });
 
             if (ord != m_order) {
                 backoffs.resize(backoffs_levels + 1, 0.0);
@@ -58,11 +66,22 @@ struct trie_prob_lm<Vocabulary, Mapper, Values, Ranks, Grams,
                 }
                 m_backoffs.add_sequence(
                     ord - 1, config.backoffs_quantization_bits, backoffs);
+                m_backoffs_ranks[ord - 2].build([&](float value) {
+                    return m_backoffs.rank(ord - 2, value, 1);  // reserved
+                });
                 uint64_t pointer_bits =
                     util::ceil_log2(stats.num_ngrams(ord + 1) + 1);
                 level.pointers.resize(n + 1, pointer_bits);
             }
         }
+
+        // written in suffix order: scattered over the largest levels
+        m_N_grams_ranks.init(stats.num_ngrams(m_order),
+                             config.probs_quantization_bits);
+        m_N_grams_words.init(stats.num_ngrams(m_order), log_vocab_size);
+        m_N_grams_pointers.init(
+            stats.num_ngrams(m_order - 1) + 1,
+            util::ceil_log2(stats.num_ngrams(m_order) + 1));
     }
 
     void set_next_word(uint64_t n, word_id id) {
@@ -77,9 +96,7 @@ struct trie_prob_lm<Vocabulary, Mapper, Values, Ranks, Grams,
 
     void set_next_backoff(uint64_t n, float backoff) {
         assert(n >= 2 and n < m_order);
-        uint64_t backoff_rank =
-            m_backoffs.rank(n - 2, std::log10(backoff), 1  // reserved
-            );
+        uint64_t backoff_rank = backoff_rank_of(n, backoff);
         uint64_t& next_pos = m_next_positions[n - 1];
         uint64_t prob_backoff_rank =
             m_arrays[n - 1].probs_backoffs_ranks[next_pos];
@@ -92,9 +109,7 @@ struct trie_prob_lm<Vocabulary, Mapper, Values, Ranks, Grams,
 
     void set_backoff(uint64_t n, uint64_t pos, float backoff) {
         assert(n >= 2 and n < m_order);
-        uint64_t backoff_rank =
-            m_backoffs.rank(n - 2, std::log10(backoff), 1  // reserved
-            );
+        uint64_t backoff_rank = backoff_rank_of(n, backoff);
         uint64_t prob_backoff_rank = m_arrays[n - 1].probs_backoffs_ranks[pos];
         uint64_t probs_quantization_bits = m_probs.quantization_bits(n - 2);
         assert(probs_quantization_bits);
@@ -114,32 +129,53 @@ struct trie_prob_lm<Vocabulary, Mapper, Values, Ranks, Grams,
         m_vocab_values.set(pos, packed);
     }
 
+    /*
+        The N-grams' word ids and ranks, and the pointers to them, are not
+        read before build(): their writes are buffered and applied in
+        batches. The other levels are also read (set_backoff reads the
+        rank of the probability), so they are written in place.
+    */
     void set_word(uint64_t n, uint64_t pos, word_id id) {
         assert(n >= 2 and n <= m_order);
+        if (n == m_order) {
+            m_N_grams_words.push(pos, id, word_writer(n));
+            return;
+        }
         m_arrays[n - 1].word_ids.set(pos, id);
     }
 
     void set_pointer(uint64_t n, uint64_t pos, uint64_t pointer) {
         assert(n >= 1 and n < m_order);
+        if (n == m_order - 1) {
+            m_N_grams_pointers.push(pos, pointer, pointer_writer(n));
+            return;
+        }
         m_arrays[n - 1].pointers.set(pos, pointer);
     }
 
     void set_prob(uint64_t n, uint64_t pos, float prob) {
         assert(n >= 2 and n <= m_order);
-        uint64_t prob_backoff_rank = m_arrays[n - 1].probs_backoffs_ranks[pos];
-        uint64_t prob_rank = m_probs.rank(n - 2, std::log10(prob), 0);
-        prob_backoff_rank |= prob_rank;
-        m_arrays[n - 1].probs_backoffs_ranks.set(pos, prob_backoff_rank);
+        uint64_t prob_rank = m_probs_ranks[n - 2].rank(
+            prob, [&](float value) { return m_probs.rank(n - 2, value, 0); });
+        if (n == m_order) {
+            m_N_grams_ranks.push(pos, prob_rank, rank_writer(n));
+            return;
+        }
+        rank_writer(n)(pos, prob_rank);
     }
 
     void build(trie_prob_lm& trie, configuration const& config) {
         trie.m_order = m_order;
         trie.m_unk_prob = std::log10(m_unk_prob);
 
+        m_N_grams_ranks.flush(rank_writer(m_order));
+        m_N_grams_words.flush(word_writer(m_order));
+        m_N_grams_pointers.flush(pointer_writer(m_order - 1));
+
         parallel_executor p(2);
         task_region(*(p.executor), [&](task_region_handle& trh) {
             trh.run([&] {
-                essentials::logger("building vocabulary");
+                util::logger("building vocabulary");
                 uint64_t vocab_size = m_vocab_values.size();
                 vocabulary vocab;
                 {
@@ -248,6 +284,11 @@ struct trie_prob_lm<Vocabulary, Mapper, Values, Ranks, Grams,
         m_probs.swap(other.m_probs);
         m_backoffs.swap(other.m_backoffs);
         m_arrays.swap(other.m_arrays);
+        m_probs_ranks.swap(other.m_probs_ranks);
+        m_backoffs_ranks.swap(other.m_backoffs_ranks);
+        m_N_grams_ranks.swap(other.m_N_grams_ranks);
+        m_N_grams_words.swap(other.m_N_grams_words);
+        m_N_grams_pointers.swap(other.m_N_grams_pointers);
     }
 
 private:
@@ -258,6 +299,36 @@ private:
     typename Values::builder m_backoffs;
     std::vector<typename sorted_array_type::estimation_builder> m_arrays;
     std::vector<uint64_t> m_next_positions;
+    std::vector<rank_table> m_probs_ranks;
+    std::vector<rank_table> m_backoffs_ranks;
+    scatter_buffer m_N_grams_ranks;
+    scatter_buffer m_N_grams_words;
+    scatter_buffer m_N_grams_pointers;
+
+    auto rank_writer(uint64_t n) {
+        return [this, n](uint64_t pos, uint64_t prob_rank) {
+            auto& ranks = m_arrays[n - 1].probs_backoffs_ranks;
+            ranks.set(pos, ranks[pos] | prob_rank);
+        };
+    }
+
+    auto word_writer(uint64_t n) {
+        return [this, n](uint64_t pos, uint64_t id) {
+            m_arrays[n - 1].word_ids.set(pos, id);
+        };
+    }
+
+    auto pointer_writer(uint64_t n) {
+        return [this, n](uint64_t pos, uint64_t pointer) {
+            m_arrays[n - 1].pointers.set(pos, pointer);
+        };
+    }
+
+    uint64_t backoff_rank_of(uint64_t n, float backoff) {
+        return m_backoffs_ranks[n - 2].rank(backoff, [&](float value) {
+            return m_backoffs.rank(n - 2, value, 1);  // reserved
+        });
+    }
 };
 
 }  // namespace tongrams
\ No newline at end of file
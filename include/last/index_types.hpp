@@ -1,7 +1,13 @@
 #pragma once
 
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
 #include "../external/tongrams/include/lm_types.hpp"
 
+#include "util_types.hpp"
+
 namespace tongrams {
 
 typedef trie_prob_lm<double_valued_mpht64,           // vocabulary
@@ -13,4 +19,38 @@ typedef trie_prob_lm<double_valued_mpht64,           // vocabulary
                      >
     reversed_trie_index;
 
+/*
+    The header of an index is the tongrams header with, in its top byte,
+    the width in bytes of the word ids of the build that wrote it.
+    Indexes written before the width was recorded have 0 there: they were
+    all built with 32-bit word ids.
+*/
+static constexpr uint64_t word_id_width_shift = 56;
+
+uint64_t index_header(uint64_t header) {
+    return header | (uint64_t(sizeof(word_id)) << word_id_width_shift);
+}
+
+// as util::load, but an index built with another word id width is rejected
+template <typename T>
+void load_index(T& data_structure, std::string const& filename) {
+    uint64_t header = 0;
+    {
+        std::ifstream is(filename, std::ifstream::binary);
+        if (!is.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            throw std::runtime_error("cannot read index '" + filename + "'");
+        }
+    }
+    uint64_t width = header >> word_id_width_shift;
+    if (width == 0) width = sizeof(uint32_t);
+    if (width != sizeof(word_id)) {
+        throw std::runtime_error(
+            "index '" + filename + "' was built with " +
+            std::to_string(8 * width) + "-bit word ids, but this build uses " +
+            std::to_string(8 * sizeof(word_id)) +
+            "-bit ones (see TONGRAMS_WORD_ID_16)");
+    }
+    util::load(data_structure, filename);
+}
+
 }  // namespace tongrams
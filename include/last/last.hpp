@@ -5,13 +5,19 @@
 #include "constants.hpp"
 #include "util.hpp"
 #include "stream.hpp"
+#include "perf_counters.hpp"
+#include "cancellation.hpp"
+#include "file_stream.hpp"
 #include "estimation_builder.hpp"
 #include "index_types.hpp"
 
 namespace tongrams {
 
+template <typename StreamGenerator>
 struct last {
     typedef stream::floats_vec<> float_vector_type;
+    static constexpr bool in_memory =
+        std::is_same<StreamGenerator, stream::memory_stream_generator>::value;
 
     last(configuration const& config, tmp::data& tmp_data,
          tmp::statistics& tmp_stats, statistics& stats)
@@ -29,19 +35,19 @@ struct last {
         , m_num_blocks(tmp_data.blocks_offsets.size())
         , m_CPU_time(0.0)
         , m_I_time(0.0)
-        , m_O_time(0.0) {
+        , m_O_time(0.0)
+        , m_build_counters(config.perf_counters)
+        , m_write_counters(config.perf_counters) {
         assert(m_num_blocks);
-        std::cout << "processing " << m_num_blocks << " blocks" << std::endl;
+        std::cerr << "processing " << m_num_blocks << " blocks" << std::endl;
         uint8_t N = m_config.max_order;
-        {
-            essentials::directory tmp_dir(m_config.tmp_dirname);
-            for (auto const& filename : tmp_dir) {
-                if (filename.extension == constants::file_extension::merged) {
-                    m_stream_generator.open(filename.fullpath);
-                    async_fetch_next_block();
-                    break;
-                }
-            }
+        if constexpr (in_memory) {
+            m_stream_generator.open(m_tmp_data.merged_blocks);
+            async_fetch_next_block();
+        } else {
+            assert(!m_tmp_data.merged_filename.empty());
+            m_stream_generator.open(m_tmp_data.merged_filename);
+            async_fetch_next_block();
         }
 
         auto start = clock_type::now();
@@ -60,6 +66,8 @@ struct last {
         std::cout << "\"CPU\":" << m_CPU_time << ", ";
         std::cout << "\"I\":" << m_I_time << ", ";
         std::cout << "\"O\":" << m_O_time << ", ";
+        m_build_counters.print("perf_build");
+        m_write_counters.print("perf_write");
     }
 
     void async_fetch_next_block() {
@@ -77,6 +85,7 @@ struct last {
     }
 
     void run() {
+        m_tmp_data.progress.phase("last", m_num_blocks, "blocks");
         auto start = clock_type::now();
 
         for (; m_current_block_id < m_num_blocks;) {
@@ -153,6 +162,8 @@ struct last {
             for (auto& p : m_probs) p.clear();
 
             ++m_current_block_id;
+            m_tmp_data.progress.add(1);
+            cancellation::check();
             if (m_current_block_id % 20 == 0) {
                 std::cerr << "processed " << m_current_block_id << "/"
                           << m_num_blocks << " blocks" << std::endl;
@@ -170,39 +181,54 @@ struct last {
 
         std::vector<float_vector_type>().swap(m_probs);
 
-        // Close but do not destroy: deleting large file from disk is expensive
-        // and we can do this after construction is over.
         m_stream_generator.close();
+        if constexpr (!in_memory) {
+            // Deleting a large file from disk is expensive: it is reclaimed
+            // in background while the index is compressed and written.
+            m_tmp_data.reclaimer.remove(m_stream_generator.filename());
+        }
         // m_index_builder.print_stats();
 
-        essentials::logger("compressing index");
+        util::logger("compressing index");
         start = clock_type::now();
         reversed_trie_index index;
-        m_index_builder.build(index, m_config);
+        {
+            perf::scope build(m_build_counters, true);
+            m_index_builder.build(index, m_config);
+        }
         end = clock_type::now();
         elapsed = end - start;
         std::cerr << "compressing index took: " << elapsed.count() << " [sec]"
                   << std::endl;
         m_CPU_time += elapsed.count();
 
-        essentials::logger("writing index");
+        util::logger("writing index");
         start = clock_type::now();
         binary_header bin_header;
         bin_header.remapping_order = 0;
         bin_header.data_structure_t = data_structure_type::pef_trie;
         bin_header.value_t = value_type::prob_backoff;
-        util::save(bin_header.get(), index, m_config.output_filename.c_str());
+        uint64_t header = index_header(bin_header.get());
+        {
+            perf::scope write(m_write_counters);
+            parallel_save(header, index, m_config.output_filename,
+                          m_config.num_threads);
+        }
         end = clock_type::now();
         elapsed = end - start;
         std::cerr << "flushing index took: " << elapsed.count() << " [sec]"
                   << std::endl;
         m_O_time = elapsed.count();
+
+#ifndef NDEBUG
+        check_saved(header, index, m_config.output_filename);
+#endif
         m_I_time = m_stream_generator.I_time();
     }
 
 private:
     configuration const& m_config;
-    stream::uncompressed_stream_generator m_stream_generator;
+    StreamGenerator m_stream_generator;
     tmp::data& m_tmp_data;
     statistics& m_stats;
 
@@ -220,6 +246,8 @@ private:
     double m_CPU_time;
     double m_I_time;
     double m_O_time;
+    perf::counters m_build_counters;
+    perf::counters m_write_counters;
 
     struct state {
         state(uint8_t N, ngrams_block::iterator begin,
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace tongrams {
+
+/*
+    Maps a probability (or backoff) in [0, 1] to the rank of the
+    quantization level of its log10 with a single lookup, indexed by the
+    exponent and the top mantissa bits of the float.
+    Since log10 and the rank are monotone, a bucket whose first and last
+    values have the same rank maps all its values to that rank; the few
+    buckets straddling a level are marked and fall back to log10 + search,
+    so the result is always the same as that of the search.
+*/
+struct rank_table {
+    static constexpr uint32_t mantissa_bits = 8;  // 256 buckets per octave
+    static constexpr uint32_t shift = 23 - mantissa_bits;
+    static constexpr uint32_t ambiguous = uint32_t(-1);
+
+    // [rank] maps a log10 value to its rank
+    template <typename Rank>
+    void build(Rank rank) {
+        uint32_t num_buckets = (bits(1.0f) >> shift) + 1;
+        m_table.resize(num_buckets);
+        for (uint32_t b = 0; b != num_buckets; ++b) {
+            uint64_t first = rank(std::log10(value(b << shift)));
+            uint64_t last = rank(std::log10(value(((b + 1) << shift) - 1)));
+            m_table[b] = first == last ? first : ambiguous;
+        }
+    }
+
+    template <typename Rank>
+    uint64_t rank(float x, Rank rank) const {
+        uint32_t b = bits(x) >> shift;  // negative and NaN are out of range
+        if (b < m_table.size() and m_table[b] != ambiguous) return m_table[b];
+        return rank(std::log10(x));
+    }
+
+    void swap(rank_table& other) {
+        m_table.swap(other.m_table);
+    }
+
+private:
+    std::vector<uint32_t> m_table;
+
+    static uint32_t bits(float x) {
+        uint32_t b;
+        std::memcpy(&b, &x, sizeof(b));
+        return b;
+    }
+
+    static float value(uint32_t b) {
+        float x;
+        std::memcpy(&x, &b, sizeof(x));
+        return x;
+    }
+};
+
+}  // namespace tongrams
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace tongrams {
+
+/*
+    Collects scattered writes (position, value) to a level of the index into
+    partitions by the high bits of the position, and applies a partition
+    when it is full.
+    A partition spans half of the L2 cache worth of entries of the level:
+    once its slice is in the cache, the writes of a batch hit it in any
+    order, so they are applied as they came, without sorting. The number of
+    partitions thus follows from the size of the level, and their capacity
+    from the memory budget of the buffer; if the budget cannot give each
+    partition a useful capacity, partitions span more.
+*/
+struct scatter_buffer {
+    static constexpr uint64_t budget_bytes = uint64_t(32) << 20;
+    static constexpr uint64_t min_capacity = 256;
+    static constexpr uint64_t max_capacity = 4096;
+
+    scatter_buffer() : m_shift(0), m_capacity(0) {}
+
+    // positions are in [0, universe); an entry of the level takes
+    // [entry_bits] bits
+    void init(uint64_t universe, uint64_t entry_bits) {
+        uint64_t span_bits = 4 * l2_cache_bytes();  // half of it, in bits
+        entry_bits = std::max<uint64_t>(entry_bits, 1);
+        m_shift = 0;
+        while ((uint64_t(2) << m_shift) * entry_bits <= span_bits) ++m_shift;
+        while (((universe >> m_shift) + 1) * min_capacity * sizeof(update) >
+               budget_bytes) {
+            ++m_shift;
+        }
+        uint64_t num_partitions = (universe >> m_shift) + 1;
+        m_capacity =
+            std::clamp<uint64_t>(budget_bytes / sizeof(update) / num_partitions,
+                                 min_capacity, max_capacity);
+        m_updates.resize(num_partitions * m_capacity);
+        m_sizes.assign(num_partitions, 0);
+    }
+
+    // [apply] is called as apply(position, value)
+    template <typename Apply>
+    void push(uint64_t pos, uint64_t value, Apply apply) {
+        uint64_t p = pos >> m_shift;
+        assert(p < m_sizes.size());
+        uint64_t& size = m_sizes[p];
+        m_updates[p * m_capacity + size] = {pos, value};
+        if (++size == m_capacity) flush(p, apply);
+    }
+
+    template <typename Apply>
+    void flush(Apply apply) {
+        for (uint64_t p = 0; p != m_sizes.size(); ++p) flush(p, apply);
+    }
+
+    void swap(scatter_buffer& other) {
+        std::swap(m_shift, other.m_shift);
+        std::swap(m_capacity, other.m_capacity);
+        m_updates.swap(other.m_updates);
+        m_sizes.swap(other.m_sizes);
+    }
+
+private:
+    struct update {
+        uint64_t pos;
+        uint64_t value;
+    };
+
+    uint64_t m_shift;
+    uint64_t m_capacity;
+    std::vector<update> m_updates;
+    std::vector<uint64_t> m_sizes;
+
+    static uint64_t l2_cache_bytes() {
+        long bytes = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+        bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+        return bytes > 0 ? bytes : uint64_t(1) << 20;
+    }
+
+    template <typename Apply>
+    void flush(uint64_t p, Apply apply) {
+        auto begin = m_updates.begin() + p * m_capacity;
+        auto end = begin + m_sizes[p];
+        for (auto it = begin; it != end; ++it) apply(it->pos, it->value);
+        m_sizes[p] = 0;
+    }
+};
+
+}  // namespace tongrams
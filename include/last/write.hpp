@@ -4,7 +4,8 @@
 
 namespace tongrams {
 
-float last::unigram_prob(word_id w) {
+template <typename StreamGenerator>
+float last<StreamGenerator>::unigram_prob(word_id w) {
     uint64_t uni_gram_count = m_tmp_stats.occs[0][w];
     uint64_t uni_gram_denominator = m_stats.num_ngrams(2);
     float u =
@@ -15,7 +16,8 @@ float last::unigram_prob(word_id w) {
     return u;
 }
 
-void last::write(uint8_t n, last::state& s) {  // write ngram
+template <typename StreamGenerator>
+void last<StreamGenerator>::write(uint8_t n, state& s) {  // write ngram
     uint8_t N = m_config.max_order;
     assert(n >= 2 and n <= N);
 
@@ -4,7 +4,10 @@
 #include "constants.hpp"
 #include "stream.hpp"
 #include "merge_utils.hpp"
+#include "io_scheduler.hpp"
 #include "merging_writer.hpp"
+#include "perf_counters.hpp"
+#include "cancellation.hpp"
 
 namespace tongrams {
 
@@ -16,31 +19,39 @@ struct merging {
     merging(configuration const& config, tmp::data& tmp_data,
             tmp::statistics& /*tmp_stats*/, statistics& /*stats*/)
         : m_config(config)
+        , m_tmp_data(tmp_data)
         , m_writer(config, tmp_data)
         , m_comparator(config.max_order)
-        , m_cursors(cursor_comparator_type(config.max_order)) {}
+        , m_cursors(cursor_comparator_type(config.max_order))
+        , m_merge_counters(config.perf_counters) {}
 
     typedef typename StreamGenerator::block_type input_block_type;
+    static constexpr bool in_memory =
+        std::is_same<StreamGenerator, stream::memory_stream_generator>::value;
+
+    void print_stats() const {
+        m_merge_counters.print("perf_merge");
+        m_writer.write_counters().print("perf_write");
+    }
 
     void run() {
         std::vector<std::string> filenames;
-        {
-            essentials::directory tmp_dir(m_config.tmp_dirname);
-            for (auto const& filename : tmp_dir) {
-                if (filename.extension == constants::file_extension::counts) {
-                    filenames.push_back(filename.fullpath);
-                }
-            }
-        }
+        if constexpr (!in_memory) filenames.swap(m_tmp_data.run_filenames);
 
         uint8_t N = m_config.max_order;
-        size_t num_files_to_merge = filenames.size();
+        size_t num_files_to_merge =
+            in_memory ? m_tmp_data.counts_blocks.size() : filenames.size();
         assert(num_files_to_merge > 0);
-        std::cerr << "merging " << num_files_to_merge << " files" << std::endl;
+        std::cerr << "merging " << num_files_to_merge
+                  << (in_memory ? " blocks in memory" : " files") << std::endl;
 
+        typedef io_scheduler<StreamGenerator, prefix_order_comparator_type>
+            io_scheduler_type;
         uint64_t record_size = ngrams_block::record_size(N);
-        uint64_t min_load_size = m_config.RAM / (2 * num_files_to_merge + 1) /
-                                 record_size * record_size;
+        // besides the blocks buffered by the scheduler, the result block
+        // and the block in the writer are alive
+        uint64_t min_load_size = io_scheduler_type::max_load_size(
+            m_config.RAM, num_files_to_merge, 2, record_size);
         uint64_t default_load_size =
             (64 * essentials::MiB) / record_size * record_size;
         uint64_t load_size = default_load_size;
@@ -51,16 +62,37 @@ struct merging {
         }
         assert(load_size % record_size == 0);
 
+        uint64_t total_bytes = 0;
         for (auto const& filename : filenames) {
+            total_bytes += util::file_size(filename.c_str());
+        }
+        for (auto const& block : m_tmp_data.counts_blocks) {
+            total_bytes += block.size() * record_size;
+        }
+        m_tmp_data.progress.phase("merging", total_bytes, "bytes");
+
+        for (size_t k = 0; k != num_files_to_merge; ++k) {
             m_stream_generators.emplace_back(N);
             auto& gen = m_stream_generators.back();
-            gen.open(filename);
+            if constexpr (in_memory) {
+                std::deque<input_block_type> run;
+                run.push_back(std::move(m_tmp_data.counts_blocks[k]));
+                gen.open(run);
+            } else {
+                gen.open(filenames[k]);
+            }
             assert(gen.size() == 0);
-            gen.fetch_next_block(load_size);
         }
+        m_tmp_data.counts_blocks.clear();
 
-        auto get_block = [](StreamGenerator& gen) {
-            auto* block = gen.get_block();
+        io_scheduler_type scheduler(
+            m_stream_generators, N, load_size,
+            std::min<uint64_t>(m_config.num_threads,
+                               io_scheduler_type::max_io_workers),
+            m_tmp_data.progress);
+
+        auto get_block = [&](uint64_t k) {
+            auto* block = scheduler.get_block(k);
             assert(block->template is_sorted<prefix_order_comparator_type>(
                 block->begin(), block->end()));
             return block;
@@ -68,8 +100,7 @@ struct merging {
 
         assert(m_cursors.empty());
         for (uint64_t k = 0; k != m_stream_generators.size(); ++k) {
-            auto& gen = m_stream_generators[k];
-            auto* block = get_block(gen);
+            auto* block = get_block(k);
             cursor<typename input_block_type::iterator> c(block->begin(),
                                                           block->end(), k);
             m_cursors.push(c);
@@ -85,6 +116,7 @@ struct merging {
 
         m_writer.start();
 
+        perf::scope merge(m_merge_counters);
         while (!m_cursors.empty()) {
             auto& top = m_cursors.top();
             auto min = *(top.range.begin);
@@ -96,9 +128,7 @@ struct merging {
                 bool equal = equal_to(min.data, back.data, sizeof_ngram(N));
                 if (!equal) {
                     if (result.size() == num_ngrams_per_block) {
-                        while (m_writer.size() > 0)
-                            ;  // wait for flush
-                        m_writer.push(result);
+                        m_writer.push(result);  // waits for flush
 
                         result.init(N);
                         result.resize_memory(num_ngrams_per_block);
@@ -114,15 +144,18 @@ struct merging {
             ++(top.range.begin);
 
             if (top.range.begin == top.range.end) {
-                auto& gen = m_stream_generators[top.index];
-                gen.release_block();
-                if (gen.eos()) {
-                    assert(gen.empty());
-                    gen.close_and_remove();
+                cancellation::check();
+                scheduler.release_block(top.index);
+                if (scheduler.exhausted(top.index)) {
+                    auto& gen = m_stream_generators[top.index];
+                    gen.close();
+                    if constexpr (!in_memory) {
+                        // reclaim the space without stalling the merge
+                        m_tmp_data.reclaimer.remove(gen.filename());
+                    }
                     m_cursors.pop();
                 } else {
-                    gen.fetch_next_block(load_size);
-                    auto* block = get_block(gen);
+                    auto* block = get_block(top.index);
                     top.range.begin = block->begin();
                     top.range.end = block->end();
                 }
@@ -137,6 +170,7 @@ struct merging {
 
 private:
     configuration const& m_config;
+    tmp::data& m_tmp_data;
     std::deque<StreamGenerator> m_stream_generators;
     merging_writer m_writer;
     prefix_order_comparator_type m_comparator;
@@ -144,6 +178,8 @@ private:
     min_heap<cursor<typename input_block_type::iterator>,
              cursor_comparator_type>
         m_cursors;
+
+    perf::counters m_merge_counters;
 };
 
 }  // namespace tongrams
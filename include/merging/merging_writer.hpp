@@ -2,13 +2,17 @@
 
 #include "configuration.hpp"
 #include "tmp.hpp"
+#include "perf_counters.hpp"
+#include "cancellation.hpp"
 
 namespace tongrams {
 
 struct merging_writer {
     merging_writer(configuration const& config, tmp::data& tmp_data)
-        : m_num_flushes(0), m_order(config.max_order), m_ngrams(0) {
-        m_buffer.open();
+        : m_num_flushes(0)
+        , m_order(config.max_order)
+        , m_ngrams(0)
+        , m_write_counters(config.perf_counters) {
         m_os.open(config.output_filename.c_str(),
                   std::ofstream::ate | std::ofstream::app);
 
@@ -24,7 +28,11 @@ struct merging_writer {
     }
 
     ~merging_writer() {
-        if (!m_buffer.empty()) {
+        if (m_thread.joinable()) {  // stopped by an exception
+            m_buffer.abort();
+            m_thread.join();
+        }
+        if (!m_buffer.empty() and !std::uncaught_exceptions()) {
             std::cerr << "Error: some data still need to be written"
                       << std::endl;
             std::terminate();
@@ -36,12 +44,11 @@ struct merging_writer {
     }
 
     void terminate() {
-        m_buffer.lock();
         m_buffer.close();
-        m_buffer.unlock();
         if (m_thread.joinable()) m_thread.join();
-        assert(!m_buffer.active());
-        while (!m_buffer.empty()) flush();
+        run();  // if the thread was not started
+        m_buffer.check();
+        assert(m_buffer.empty());
         m_os.close();
 
         // write number of ngrams at the beginning of file
@@ -57,20 +64,15 @@ struct merging_writer {
     }
 
     void push(ngrams_block& block) {
-        m_buffer.lock();
-        m_buffer.push(block);
-        m_buffer.unlock();
+        m_buffer.push(block);  // waits for the previous block to be done
     }
 
-    size_t size() {
-        m_buffer.lock();
-        size_t s = m_buffer.size();
-        m_buffer.unlock();
-        return s;
+    perf::counters const& write_counters() const {
+        return m_write_counters;
     }
 
 private:
-    semi_sync_queue<ngrams_block> m_buffer;
+    channel<ngrams_block> m_buffer;
     std::ofstream m_os;
     std::thread m_thread;
     uint64_t m_num_flushes;
@@ -78,35 +80,40 @@ private:
     uint64_t m_ngrams;
     vocabulary m_vocab;
     boost::iostreams::mapped_file_params m_params;
+    perf::counters m_write_counters;
 
     void run() {
-        while (m_buffer.active()) flush();
+        try {
+            while (auto* block = m_buffer.front()) {
+                flush(*block);
+                m_buffer.pop();
+            }
+        } catch (...) {  // rethrown on the producer thread
+            m_buffer.fail(std::current_exception());
+        }
     }
 
-    void flush() {
-        m_buffer.lock();
-        if (m_buffer.empty()) {
-            m_buffer.unlock();
+    void flush(ngrams_block& block) {
+        if (cancellation::requested()) {  // drop, do not write
+            block.release();
             return;
         }
-        auto& block = m_buffer.pick();
-        m_buffer.unlock();
-
-        for (auto const ngram : block) {
-            for (uint64_t i = 0; i != m_order; ++i) {
-                auto br = m_vocab[ngram[i]];
-                util::write(m_os, br);
-                if (i != m_order - 1) m_os << " ";
+
+        {
+            perf::scope write(m_write_counters);
+            for (auto const ngram : block) {
+                for (uint64_t i = 0; i != m_order; ++i) {
+                    auto br = m_vocab[ngram[i]];
+                    util::write(m_os, br);
+                    if (i != m_order - 1) m_os << " ";
+                }
+                m_os << "\t" << *ngram.value(m_order) << "\n";
             }
-            m_os << "\t" << *ngram.value(m_order) << "\n";
         }
 
         m_ngrams += block.size();
         block.release();
 
-        m_buffer.lock();
-        m_buffer.pop();
-        m_buffer.unlock();
         ++m_num_flushes;
         if (m_num_flushes % 20 == 0) {
             std::cerr << "flushed " << m_num_flushes << " blocks" << std::endl;
@@ -182,7 +182,7 @@ struct ngrams_block {
         return m_allocator.order();
     }
 
-    void write_memory(std::ofstream& os) {
+    void write_memory(std::ostream& os) {
         assert(m_memory.size() > 0);
         std::streamsize num_bytes = size() * record_size();
         os.write(reinterpret_cast<char const*>(m_memory.data()), num_bytes);
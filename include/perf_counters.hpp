@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace tongrams::perf {
+
+enum event { cycles = 0, instructions, llc_misses, dtlb_misses, branch_misses };
+static constexpr int num_events = 5;
+
+static const char* event_names[num_events] = {
+    "cycles", "instructions", "LLC_misses", "dTLB_misses", "branch_misses"};
+
+/*
+    Hardware counters accumulated over one or more scopes.
+    A counter is invalid if the kernel refused to open it: this happens
+    when perf_event_paranoid is too restrictive, inside some containers
+    and VMs, or on machines lacking the specific event.
+*/
+struct counters {
+    counters(bool enabled = false) : m_enabled(enabled), m_scopes(0) {
+        for (int i = 0; i != num_events; ++i) {
+            values[i] = 0;
+            valid[i] = true;
+        }
+    }
+
+    bool enabled() const {
+        return m_enabled;
+    }
+
+    bool available() const {
+        return m_scopes > 0;
+    }
+
+    void add(uint64_t const* deltas, bool const* opened) {
+        for (int i = 0; i != num_events; ++i) {
+            values[i] += deltas[i];
+            valid[i] = valid[i] and opened[i];
+        }
+        ++m_scopes;
+    }
+
+    // print as a JSON field, followed by a separator
+    void print(std::string const& name) const {
+        if (!enabled()) return;
+        std::cout << "\"" << name << "\":";
+        if (!available()) {
+            std::cout << "null, ";
+            return;
+        }
+        std::cout << "{";
+        for (int i = 0; i != num_events; ++i) {
+            std::cout << "\"" << event_names[i] << "\":";
+            if (valid[i]) {
+                std::cout << values[i];
+            } else {
+                std::cout << "null";
+            }
+            std::cout << ", ";
+        }
+        std::cout << "\"IPC\":";
+        if (valid[cycles] and valid[instructions] and values[cycles]) {
+            std::cout << static_cast<double>(values[instructions]) /
+                             values[cycles];
+        } else {
+            std::cout << "null";
+        }
+        std::cout << "}, ";
+    }
+
+    uint64_t values[num_events];
+    bool valid[num_events];
+
+private:
+    bool m_enabled;
+    uint64_t m_scopes;
+};
+
+/*
+    Opens a group of counters measuring the calling thread (and, if
+    inherit is true, the threads it spawns afterwards) for the lifetime
+    of the object, and adds the counts to the given accumulator.
+    If counters are disabled or cannot be opened, it does nothing.
+*/
+struct scope {
+    scope(counters& c, bool inherit = false) : m_counters(c), m_open(false) {
+        for (int i = 0; i != num_events; ++i) {
+            m_fds[i] = -1;
+            m_opened[i] = false;
+        }
+        if (m_counters.enabled()) open(inherit);
+    }
+
+    ~scope() {
+#ifdef __linux__
+        if (m_open) {
+            ioctl(m_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            uint64_t deltas[num_events] = {0};
+            for (int i = 0; i != num_events; ++i) {
+                if (m_opened[i]) deltas[i] = read_scaled(m_fds[i]);
+            }
+            m_counters.add(deltas, m_opened);
+        }
+        for (int i = num_events - 1; i >= 0; --i) {
+            if (m_fds[i] != -1) close(m_fds[i]);
+        }
+#endif
+    }
+
+private:
+    counters& m_counters;
+    bool m_open;
+    int m_fds[num_events];
+    bool m_opened[num_events];
+
+#ifdef __linux__
+    static int open_event(uint32_t type, uint64_t config, bool inherit,
+                          int group_fd) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group_fd == -1;  // the leader drives the group
+        attr.inherit = inherit;
+        attr.exclude_kernel = 1;  // allowed with perf_event_paranoid <= 2
+        attr.exclude_hv = 1;
+        attr.read_format =
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return syscall(__NR_perf_event_open, &attr, 0 /* calling thread */,
+                       -1 /* any cpu */, group_fd, 0);
+    }
+
+    // account for multiplexing when more events than hardware counters
+    static uint64_t read_scaled(int fd) {
+        uint64_t data[3] = {0, 0, 0};  // value, time enabled, time running
+        if (read(fd, data, sizeof(data)) != sizeof(data)) return 0;
+        if (data[2] == 0) return 0;
+        if (data[2] < data[1]) {
+            return static_cast<uint64_t>(static_cast<double>(data[0]) *
+                                         data[1] / data[2]);
+        }
+        return data[0];
+    }
+
+    void open(bool inherit) {
+        static const uint64_t dtlb_read_misses =
+            PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        static const std::pair<uint32_t, uint64_t> events[num_events] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HW_CACHE, dtlb_read_misses},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+
+        m_fds[0] = open_event(events[0].first, events[0].second, inherit, -1);
+        if (m_fds[0] == -1) {
+            warn(errno);
+            return;
+        }
+        m_opened[0] = true;
+        for (int i = 1; i != num_events; ++i) {
+            m_fds[i] = open_event(events[i].first, events[i].second, inherit,
+                                  m_fds[0]);
+            m_opened[i] = m_fds[i] != -1;
+        }
+        ioctl(m_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        m_open = true;
+    }
+#else
+    void open(bool) {
+        warn(ENOSYS);
+    }
+#endif
+
+    static void warn(int err) {
+        static std::atomic<bool> warned(false);
+        if (warned.exchange(true)) return;
+        std::cerr << "Warning: hardware performance counters are not "
+                     "available ("
+                  << std::strerror(err)
+                  << "): check /proc/sys/kernel/perf_event_paranoid"
+                  << std::endl;
+    }
+};
+
+}  // namespace tongrams::perf
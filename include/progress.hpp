@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "util_types.hpp"
+#include "cancellation.hpp"
+
+namespace tongrams {
+
+/*
+    Reports the progress of the current step at a fixed interval,
+    either to std::cerr or to a status file (in JSON format) that is
+    atomically replaced at every report so that it can be polled.
+    The amount of work is measured in bytes for counting (corpus consumed)
+    and merging (runs consumed), and in blocks for the last step.
+*/
+struct progress_reporter {
+    progress_reporter()
+        : m_interval(0.0), m_stop(false), m_total(0), m_done(0), m_runs(0) {}
+
+    // not finished: the run failed or was cancelled
+    ~progress_reporter() {
+        stop(cancellation::requested() ? "cancelled" : "failed");
+    }
+
+    void start(double interval, std::string const& status_filename) {
+        if (interval <= 0.0) return;
+        m_interval = interval;
+        m_status_filename = status_filename;
+        m_start = clock_type::now();
+        m_stop = false;
+        m_thread = std::thread(&progress_reporter::run, this);
+    }
+
+    // the run completed
+    void finish() {
+        stop("done");
+    }
+
+    void stop(std::string const& status) {
+        if (!m_thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+        if (!m_status_filename.empty()) {  // leave a final status
+            phase(status, 0, "");
+            report();
+        }
+    }
+
+    // begin a new step whose amount of work is [total] units
+    void phase(std::string const& name, uint64_t total,
+               std::string const& unit) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_phase = name;
+        m_unit = unit;
+        m_phase_start = clock_type::now();
+        m_total = total;
+        m_done = 0;
+    }
+
+    void add(uint64_t units) {
+        m_done.fetch_add(units, std::memory_order_relaxed);
+    }
+
+    void add_run() {
+        m_runs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    double m_interval;  // in seconds
+    std::string m_status_filename;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+
+    std::string m_phase;
+    std::string m_unit;
+    clock_type::time_point m_start;
+    clock_type::time_point m_phase_start;
+    std::atomic<uint64_t> m_total;
+    std::atomic<uint64_t> m_done;
+    std::atomic<uint64_t> m_runs;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto interval = std::chrono::duration<double>(m_interval);
+        while (!m_cv.wait_for(lock, interval, [&] { return m_stop; })) {
+            lock.unlock();
+            report();
+            lock.lock();
+        }
+    }
+
+    static std::string hms(double seconds) {
+        uint64_t s = static_cast<uint64_t>(seconds);
+        std::ostringstream os;
+        os << std::setfill('0') << std::setw(2) << s / 3600 << ":"
+           << std::setw(2) << (s / 60) % 60 << ":" << std::setw(2) << s % 60;
+        return os.str();
+    }
+
+    void report() {
+        std::string phase, unit;
+        double phase_elapsed = 0.0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            phase = m_phase;
+            unit = m_unit;
+            std::chrono::duration<double> e = clock_type::now() - m_phase_start;
+            phase_elapsed = e.count();
+        }
+        std::chrono::duration<double> e = clock_type::now() - m_start;
+        double elapsed = e.count();
+        uint64_t total = m_total.load(std::memory_order_relaxed);
+        uint64_t done = m_done.load(std::memory_order_relaxed);
+        if (done > total) done = total;
+        uint64_t runs = m_runs.load(std::memory_order_relaxed);
+
+        double percentage = total ? done * 100.0 / total : 100.0;
+        double throughput = phase_elapsed > 0.0 ? done / phase_elapsed : 0.0;
+        double eta = (throughput > 0.0) ? (total - done) / throughput : -1.0;
+
+        if (m_status_filename.empty()) {
+            bool bytes = unit == "bytes";
+            double scale = bytes ? essentials::MiB : 1.0;
+            std::string u = bytes ? " MiB" : " " + unit;
+            std::ostringstream os;
+            os << std::fixed << std::setprecision(1) << "[progress] " << phase
+               << ": " << done / scale << "/" << total / scale << u << " ("
+               << percentage << "%) at " << throughput / scale << u << "/s, "
+               << runs << " runs written, elapsed " << hms(elapsed)
+               << ", ETA " << (eta < 0.0 ? std::string("n/a") : hms(eta));
+            std::cerr << os.str() << std::endl;
+            return;
+        }
+
+        // write-then-rename, so that pollers never see a partial file
+        std::string tmp_filename = m_status_filename + ".tmp";
+        {
+            std::ofstream os(tmp_filename.c_str());
+            os << "{\"step\":\"" << phase << "\", \"unit\":\"" << unit
+               << "\", \"done\":" << done << ", \"total\":" << total
+               << ", \"percentage\":" << percentage
+               << ", \"throughput\":" << throughput
+               << ", \"runs_written\":" << runs
+               << ", \"elapsed\":" << elapsed << ", \"eta\":";
+            if (eta < 0.0) {
+                os << "null";
+            } else {
+                os << eta;
+            }
+            os << "}\n";
+        }
+        std::rename(tmp_filename.c_str(), m_status_filename.c_str());
+    }
+};
+
+}  // namespace tongrams
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "cancellation.hpp"
+#include "scoring.hpp"
+
+namespace tongrams {
+
+/*
+    Serves score requests over a Unix domain socket, with one model shared
+    by all the clients.
+    A request is a sentence terminated by '\n'; the response is the sum of
+    the log10 probabilities of its words, terminated by '\n'. Requests can
+    be pipelined: responses follow the order of the requests of the same
+    connection.
+    Each connection has a (detached) reader thread that queues its
+    requests; a pool of workers takes them in batches, so as to take the
+    lock once per batch, and scores them one after the other.
+    Micro-batching is adaptive: a worker waits up to [max_wait_us] for a
+    fuller batch only when recent batches were at least half full, i.e.,
+    under load; otherwise it scores what is queued right away.
+*/
+template <typename Model>
+struct score_server {
+    static constexpr uint64_t default_batch_size = 16;
+
+    score_server(Model& model, std::string const& socket_path,
+                 uint64_t num_workers, uint64_t max_batch_size,
+                 uint64_t max_wait_us)
+        : m_model(model)
+        , m_socket_path(socket_path)
+        , m_num_workers(num_workers)
+        , m_max_batch_size(max_batch_size)
+        , m_max_wait_us(max_wait_us)
+        , m_fill(0.0)
+        , m_stop(false)
+        , m_num_readers(0)
+        , m_num_requests(0)
+        , m_num_batches(0)
+        , m_num_connections(0) {
+        sockaddr_un addr;
+        if (socket_path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("socket path too long");
+        }
+        m_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_fd == -1) fail("socket");
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, socket_path.c_str());
+        ::unlink(socket_path.c_str());
+        if (::bind(m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+            fail("bind");
+        }
+        if (::listen(m_fd, SOMAXCONN)) fail("listen");
+    }
+
+    ~score_server() {
+        ::close(m_fd);
+        ::unlink(m_socket_path.c_str());
+    }
+
+    // serve until SIGTERM or SIGINT
+    void run() {
+        for (uint64_t i = 0; i != m_num_workers; ++i) {
+            m_workers.emplace_back(&score_server::work, this);
+        }
+
+        while (!cancellation::requested()) {
+            pollfd p = {m_fd, POLLIN, 0};
+            if (::poll(&p, 1, 100) <= 0) continue;  // timeout or signal
+            int fd = ::accept(m_fd, nullptr, nullptr);
+            if (fd == -1) continue;
+            auto conn = std::make_shared<connection>(fd);
+            // forget the connections closed so far
+            m_connections.erase(
+                std::remove_if(m_connections.begin(), m_connections.end(),
+                               [](auto const& c) { return c.expired(); }),
+                m_connections.end());
+            m_connections.push_back(conn);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ++m_num_readers;
+            }
+            std::thread(&score_server::read, this, conn).detach();
+            ++m_num_connections;
+        }
+
+        // unblock the readers, then let the workers drain the queue
+        for (auto& c : m_connections) {
+            if (auto conn = c.lock()) ::shutdown(conn->fd, SHUT_RDWR);
+        }
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_readers_done.wait(lock, [&] { return m_num_readers == 0; });
+            m_stop = true;
+        }
+        m_work.notify_all();
+        for (auto& t : m_workers) t.join();
+    }
+
+    void print_stats() const {
+        std::cout << "\"connections\":" << m_num_connections << ", ";
+        std::cout << "\"requests\":" << m_num_requests << ", ";
+        std::cout << "\"batches\":" << m_num_batches << ", ";
+        std::cout << "\"mean_batch_size\":"
+                  << (m_num_batches ? double(m_num_requests) / m_num_batches
+                                    : 0.0);
+    }
+
+private:
+    struct connection {
+        connection(int fd) : fd(fd), next_seq(0), next_to_send(0) {}
+
+        ~connection() {
+            ::close(fd);
+        }
+
+        // responses are sent in the order of the requests
+        void respond(uint64_t seq, std::string&& response) {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.emplace(seq, std::move(response));
+            auto it = pending.begin();
+            while (it != pending.end() and it->first == next_to_send) {
+                send(it->second);
+                ++next_to_send;
+                it = pending.erase(it);
+            }
+        }
+
+        int fd;
+        uint64_t next_seq;  // only used by the reader
+        uint64_t next_to_send;
+        std::mutex mutex;
+        std::map<uint64_t, std::string> pending;
+
+    private:
+        void send(std::string const& s) {
+            char const* p = s.data();
+            size_t left = s.size();
+            while (left) {
+                ssize_t w = ::send(fd, p, left, MSG_NOSIGNAL);
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    return;  // the client is gone
+                }
+                p += w;
+                left -= w;
+            }
+        }
+    };
+
+    struct request {
+        std::shared_ptr<connection> conn;
+        uint64_t seq;
+        std::string text;
+    };
+
+    Model& m_model;
+    std::string m_socket_path;
+    int m_fd;
+    uint64_t m_num_workers;
+    uint64_t m_max_batch_size;
+    uint64_t m_max_wait_us;
+    double m_fill;  // moving average of the fraction of full batches
+
+    std::deque<request> m_requests;
+    bool m_stop;
+    uint64_t m_num_readers;  // live reader threads, which are detached
+    std::mutex m_mutex;
+    std::condition_variable m_work;
+    std::condition_variable m_readers_done;
+
+    std::vector<std::thread> m_workers;
+    std::vector<std::weak_ptr<connection>> m_connections;  // may be closed
+
+    uint64_t m_num_requests;
+    uint64_t m_num_batches;
+    uint64_t m_num_connections;
+
+    void fail(std::string const& what) {
+        int e = errno;
+        if (m_fd != -1) ::close(m_fd);
+        throw std::runtime_error(what + " '" + m_socket_path +
+                                 "': " + std::strerror(e));
+    }
+
+    void read(std::shared_ptr<connection> conn) {
+        std::string buffer;
+        std::vector<char> chunk(64 * essentials::KiB);
+        std::vector<request> requests;
+        while (true) {
+            ssize_t r = ::recv(conn->fd, chunk.data(), chunk.size(), 0);
+            if (r < 0 and errno == EINTR) continue;
+            if (r <= 0) break;
+            buffer.append(chunk.data(), r);
+            size_t begin = 0;
+            size_t end = 0;
+            while ((end = buffer.find('\n', begin)) != std::string::npos) {
+                requests.push_back({conn, conn->next_seq++,
+                                    buffer.substr(begin, end - begin)});
+                begin = end + 1;
+            }
+            buffer.erase(0, begin);
+            if (requests.empty()) continue;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for (auto& r : requests) m_requests.push_back(std::move(r));
+            }
+            requests.clear();
+            m_work.notify_all();
+        }
+        conn.reset();  // close the connection, unless requests are pending
+
+        // notify with the lock held: once it is released, the server may
+        // be destroyed
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_num_readers == 0) m_readers_done.notify_all();
+    }
+
+    void work() {
+        typename Model::state_type state(m_model.order());
+        std::vector<request> batch;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_work.wait(lock,
+                            [&] { return m_stop or !m_requests.empty(); });
+                if (m_requests.empty()) return;  // stopped and drained
+                if (m_requests.size() < m_max_batch_size and m_fill >= 0.5 and
+                    m_max_wait_us and !m_stop) {
+                    m_work.wait_for(
+                        lock, std::chrono::microseconds(m_max_wait_us), [&] {
+                            return m_stop or
+                                   m_requests.size() >= m_max_batch_size;
+                        });
+                    if (m_requests.empty()) continue;  // taken by others
+                }
+                uint64_t n =
+                    std::min<uint64_t>(m_requests.size(), m_max_batch_size);
+                for (uint64_t i = 0; i != n; ++i) {
+                    batch.push_back(std::move(m_requests.front()));
+                    m_requests.pop_front();
+                }
+                m_fill = 0.9 * m_fill + 0.1 * double(n) / m_max_batch_size;
+                m_num_requests += n;
+                ++m_num_batches;
+            }
+
+            for (auto& r : batch) {
+                auto begin = reinterpret_cast<uint8_t const*>(r.text.data());
+                float log10_prob = 0.0;
+                state.init();
+                scoring::for_each_word(
+                    {begin, begin + r.text.size()},
+                    [&](byte_range word) {
+                        bool is_OOV = false;
+                        log10_prob += m_model.score(state, word, is_OOV);
+                    },
+                    [] {});
+                r.conn->respond(r.seq, std::to_string(log10_prob) + "\n");
+            }
+            batch.clear();
+        }
+    }
+};
+
+}  // namespace tongrams
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <array>
+#include <cmath>
+
+#include "util.hpp"
+#include "util_types.hpp"
+#include "last/index_types.hpp"
+#include "counting/hash_utils.hpp"
+
+namespace tongrams::scoring {
+
+/*
+    Text to score: one sentence per line, words separated by spaces.
+    The model state is reset at the beginning of each line.
+*/
+struct corpus {
+    corpus(std::string const& filename) {
+        m_file.open(filename);
+        util::check_file(m_file);
+        m_data = reinterpret_cast<uint8_t const*>(m_file.data());
+        util::optimize_sequential_access(m_data, m_file.size());
+    }
+
+    byte_range text() const {
+        return {m_data, m_data + m_file.size()};
+    }
+
+    // split the text into [num_shards] ranges, each made of whole lines
+    std::vector<byte_range> shards(uint64_t num_shards) const {
+        auto t = text();
+        uint64_t size = t.second - t.first;
+        std::vector<byte_range> shards;
+        uint8_t const* begin = t.first;
+        for (uint64_t i = 1; i <= num_shards and begin != t.second; ++i) {
+            uint8_t const* end =
+                std::max(begin, t.first + size * i / num_shards);
+            while (end != t.second and (end == begin or *(end - 1) != '\n')) {
+                ++end;
+            }
+            if (i == num_shards) end = t.second;
+            if (end != begin) shards.emplace_back(begin, end);
+            begin = end;
+        }
+        return shards;
+    }
+
+private:
+    boost::iostreams::mapped_file_source m_file;
+    uint8_t const* m_data;
+};
+
+// call f(word) for each word of each line, and l() at the end of each line
+template <typename OnWord, typename OnLine>
+void for_each_word(byte_range text, OnWord f, OnLine l) {
+    uint8_t const* p = text.first;
+    uint8_t const* word = p;
+    bool words_in_line = false;
+    for (; p != text.second; ++p) {
+        if (*p == ' ' or *p == '\n') {
+            if (p != word) {
+                f(byte_range(word, p));
+                words_in_line = true;
+            }
+            word = p + 1;
+            if (*p == '\n' and words_in_line) {
+                l();
+                words_in_line = false;
+            }
+        }
+    }
+    if (p != word) {
+        f(byte_range(word, p));
+        words_in_line = true;
+    }
+    if (words_in_line) l();
+}
+
+struct score_stats {
+    score_stats() : log10_prob(0.0), tokens(0), OOVs(0), sentences(0) {}
+
+    score_stats& operator+=(score_stats const& other) {
+        log10_prob += other.log10_prob;
+        tokens += other.tokens;
+        OOVs += other.OOVs;
+        sentences += other.sentences;
+        return *this;
+    }
+
+    double perplexity() const {
+        return tokens ? std::pow(10.0, -log10_prob / tokens) : 0.0;
+    }
+
+    double log10_prob;  // sum of the log10 probabilities of all tokens
+    uint64_t tokens;
+    uint64_t OOVs;
+    uint64_t sentences;
+};
+
+template <typename Model>
+score_stats score(Model& model, byte_range text) {
+    score_stats stats;
+    typename Model::state_type state(model.order());
+    state.init();
+    for_each_word(
+        text,
+        [&](byte_range word) {
+            bool is_OOV = false;
+            stats.log10_prob += model.score(state, word, is_OOV);
+            stats.OOVs += is_OOV;
+            ++stats.tokens;
+        },
+        [&]() {
+            ++stats.sentences;
+            state.init();
+        });
+    return stats;
+}
+
+typedef std::vector<byte_range> query;  // words scored from a fresh state
+
+// the first [max_queries] [order]-grams of the text, not crossing lines
+std::vector<query> ngrams(byte_range text, uint64_t order,
+                          uint64_t max_queries) {
+    std::vector<query> queries;
+    query window;
+    for_each_word(
+        text,
+        [&](byte_range word) {
+            if (window.size() == order) window.erase(window.begin());
+            window.push_back(word);
+            if (window.size() == order and queries.size() < max_queries) {
+                queries.push_back(window);
+            }
+        },
+        [&]() { window.clear(); });
+    return queries;
+}
+
+/*
+    Bounded cache in front of a model, for workloads that score the same
+    contexts over and over (beam search, n-best rescoring, sliding
+    histories). An entry maps a word and the (up to N - 1) words before it,
+    identified by their 64-bit hashes, to the probability of the word: on a
+    hit, the lookup in the model is skipped.
+    The cache is direct-mapped: a new entry replaces the one in its slot.
+    Entries have a fixed size, bounded by the maximum order, and hold no
+    pointers, so that a hit touches one entry only. They do not hold the
+    model state either, whose type is internal to the model: the state is
+    the last N - 1 words, kept in the cache's own state.
+    On a hit, the model state is either left behind, to be rebuilt from
+    those words on the next miss (lazy), at the cost of up to N - 1 model
+    lookups, or advanced with one lookup (eager), which saves nothing but
+    replays nothing. The cache stays lazy while runs of hits save more
+    lookups than the replays that end them cost, on a moving average of
+    the recent runs: a miss costs at most N - 1 extra lookups, and only
+    while replaying pays off on average. lookups() counts all the model
+    lookups, replays included.
+    It has the same interface as a model, so it can be passed to score();
+    the words of a sentence must stay valid while it is scored.
+*/
+template <typename Model>
+struct cached_model {
+    static constexpr uint64_t max_context = global::max_order - 1;
+
+    struct state_type {
+        state_type(uint64_t order)
+            : model_state(order), size(0), run(0), synced(true) {}
+
+        // the run of hits of the previous words, if any, is kept: it
+        // ended without a replay
+        void init() {
+            model_state.init();
+            size = 0;
+            synced = true;
+        }
+
+        typename Model::state_type model_state;  // if synced
+        std::array<uint64_t, max_context> history;  // hashes of the last words
+        std::array<byte_range, max_context> words;  // the last words
+        uint64_t size;
+        uint64_t run;  // hits since the last miss or the last init()
+        bool synced;   // model_state follows the last words
+    };
+
+    // [capacity] is rounded up to a power of 2
+    cached_model(Model& model, uint64_t capacity)
+        : m_model(model)
+        , m_order(model.order())
+        , m_hits(0)
+        , m_misses(0)
+        , m_lookups(0)
+        , m_replayed(0)
+        , m_gain(1.0)
+        , m_lazy(true) {
+        assert(m_order >= 1 and m_order - 1 <= max_context);
+        uint64_t c = 1;
+        while (c < capacity) c *= 2;
+        m_mask = c - 1;
+        m_entries.resize(c);
+    }
+
+    uint64_t order() const {
+        return m_order;
+    }
+
+    float score(state_type& state, byte_range word, bool& is_OOV) {
+        if (state.size == 0 and state.run) end_run(state, 0);
+        uint64_t* key = m_key.data();
+        key[0] = state.size;
+        std::copy(state.history.begin(), state.history.begin() + state.size,
+                  key + 1);
+        key[state.size + 1] = hash_utils::byte_range_hash64(word);
+        uint64_t len = state.size + 2;
+        uint64_t h = hash_utils::murmur_hash64(key, len * sizeof(uint64_t), 0);
+
+        auto& e = m_entries[h & m_mask];
+        float log10_prob = 0.0;
+        if (e.valid and std::equal(key, key + len, e.key.begin())) {
+            ++m_hits;
+            log10_prob = e.log10_prob;
+            is_OOV = e.is_OOV;
+            ++state.run;
+            if (m_lazy) {
+                state.synced = false;
+            } else {
+                if (!state.synced) sync(state);
+                bool OOV = false;
+                m_model.score(state.model_state, word, OOV);
+                ++m_lookups;
+            }
+        } else {
+            ++m_misses;
+            if (state.run) end_run(state, state.size);
+            if (!state.synced) sync(state);
+            log10_prob = m_model.score(state.model_state, word, is_OOV);
+            ++m_lookups;
+            std::copy(key, key + len, e.key.begin());
+            e.log10_prob = log10_prob;
+            e.is_OOV = is_OOV;
+            e.valid = true;
+        }
+
+        // shift the word into the history
+        uint64_t word_hash = key[state.size + 1];
+        uint64_t context = m_order - 1;
+        if (state.size == context) {
+            if (context) {
+                std::copy(state.history.begin() + 1,
+                          state.history.begin() + context,
+                          state.history.begin());
+                std::copy(state.words.begin() + 1,
+                          state.words.begin() + context, state.words.begin());
+                state.history[context - 1] = word_hash;
+                state.words[context - 1] = word;
+            }
+        } else {
+            state.history[state.size] = word_hash;
+            state.words[state.size] = word;
+            ++state.size;
+        }
+
+        return log10_prob;
+    }
+
+    uint64_t hits() const {
+        return m_hits;
+    }
+
+    uint64_t misses() const {
+        return m_misses;
+    }
+
+    double hit_rate() const {
+        uint64_t lookups = m_hits + m_misses;
+        return lookups ? double(m_hits) / lookups : 0.0;
+    }
+
+    // lookups in the model, replays included
+    uint64_t lookups() const {
+        return m_lookups;
+    }
+
+    // lookups in the model spent rebuilding states after runs of hits
+    uint64_t replayed() const {
+        return m_replayed;
+    }
+
+private:
+    struct entry {
+        entry() : log10_prob(0.0), is_OOV(false), valid(false) {}
+        std::array<uint64_t, max_context + 2> key;  // size, words, hash
+        float log10_prob;
+        bool is_OOV;
+        bool valid;
+    };
+
+    Model& m_model;
+    uint64_t m_order;
+    uint64_t m_mask;
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_lookups;
+    uint64_t m_replayed;
+    double m_gain;  // moving average of the lookups saved by runs of hits
+    bool m_lazy;    // leave the model state behind on hits
+    std::vector<entry> m_entries;
+    std::array<uint64_t, max_context + 2> m_key;  // of the current lookup
+
+    // a run of hits ends with a replay of [replay] lookups, if lazy: the
+    // run saved that many lookups less than it would have cost if eager
+    void end_run(state_type& state, uint64_t replay) {
+        double gain = double(state.run) - double(replay);
+        m_gain = 0.9 * m_gain + 0.1 * gain;
+        m_lazy = m_gain > 0.0;
+        state.run = 0;
+    }
+
+    // the model state after the last words, scored from a fresh state
+    void sync(state_type& state) {
+        state.model_state.init();
+        for (uint64_t i = 0; i != state.size; ++i) {
+            bool is_OOV = false;
+            m_model.score(state.model_state, state.words[i], is_OOV);
+        }
+        m_lookups += state.size;
+        m_replayed += state.size;
+        state.synced = true;
+    }
+};
+
+}  // namespace tongrams::scoring
@@ -20,7 +20,10 @@ struct statistics {
             , m_D(config.max_order, std::vector<float>(4, 0))
             , m_num_ngrams(config.max_order, 0)
             , m_total_num_words(0)
-            , m_unk_prob(0.0) {}
+            , m_unk_prob(0.0)
+            , m_num_threads(
+                  std::min<uint64_t>(config.num_threads, config.max_order))
+            , m_executor(m_num_threads) {}
 
         void init(size_t vocab_size) {
             assert(vocab_size);
@@ -35,8 +38,16 @@ struct statistics {
             }
         }
 
+        /*
+            The state updated for each order (range ids, left extensions,
+            modified counts, probs_offsets[n]) is disjoint from that of the
+            other orders: each order scans the (read-only) block on its
+            own thread, with another thread for the N-gram counts.
+            With a single thread, the block is scanned once for all orders.
+        */
         template <typename Iterator>
         void compute_left_extensions(Iterator begin, size_t len) {
+            if (len == 0) return;
             uint64_t N = m_config.max_order;
             m_num_ngrams[N - 1] += len;
 
@@ -45,39 +56,26 @@ struct statistics {
                 prev_ptr = m_ngram_cache.get();
             }
 
-            for (size_t i = 0; i < len; ++i, ++begin) {
-                auto ptr = *begin;
-                word_id right = ptr[N - 1];
-
-                for (uint64_t n = 1; n < N; ++n) {
-                    bool context_changes =
-                        !ptr.equal_to(prev_ptr, N - n, N - 1);
-                    if (n != 1 and context_changes) {
-                        m_tmp_stats.combine(n);
-                        ++m_num_ngrams[n - 2];  // previous order
-                    }
-
-                    word_id left = ptr[N - n - 1];
-                    if (m_tmp_stats.update(n, left, right)) {
-                        ++m_tmp_data.probs_offsets[n][right];
-                    }
-                }
-
-                if (!ptr.equal_to(prev_ptr, 0, N - 1)) ++m_num_ngrams[N - 2];
-
-                // N-gram case: they do not have modified counts,
-                // rather their counts are equal to the occurrence in corpus
-                uint64_t count = *(ptr.value(N));
-                assert(count > 0);
-                m_total_num_words += count;
-                if (count <= 4) ++m_tmp_stats.t[N - 1][count - 1];
-                prev_ptr = ptr;
+            if (m_num_threads == 1) {
+                scan(begin, len, prev_ptr);
+            } else {
+                task_region(
+                    *(m_executor.executor), [&](task_region_handle& trh) {
+                        for (uint64_t n = 1; n < N; ++n) {
+                            trh.run([&, n] {
+                                scan_left_extensions(n, begin, len, prev_ptr);
+                            });
+                        }
+                        trh.run([&] { scan_counts(begin, len, prev_ptr); });
+                    });
             }
 
-            m_ngram_cache.store(prev_ptr);
+            // prev_ptr may point into the cache: store after the scans
+            m_ngram_cache.store(*(begin + (len - 1)));
         }
 
         void finalize() {
+            m_tmp_stats.release(1);  // the next step only needs occs[0]
             ++m_num_ngrams[m_config.max_order - 2];
             for (uint64_t n = 2; n < m_config.max_order; ++n) {
                 ++m_num_ngrams[n - 2];
@@ -169,6 +167,90 @@ struct statistics {
         float m_unk_prob;  // prob of <unk> word, which is backoff(empty) /
                            // vocabulary_size
 
+        uint64_t m_num_threads;
+        parallel_executor m_executor;
+
+        // all orders in one pass
+        template <typename Iterator, typename Pointer>
+        void scan(Iterator it, size_t len, Pointer prev_ptr) {
+            uint64_t N = m_config.max_order;
+            for (size_t i = 0; i < len; ++i, ++it) {
+                auto ptr = *it;
+                word_id right = ptr[N - 1];
+
+                for (uint64_t n = 1; n < N; ++n) {
+                    bool context_changes =
+                        !ptr.equal_to(prev_ptr, N - n, N - 1);
+                    if (n != 1 and context_changes) {
+                        m_tmp_stats.combine(n);
+                        ++m_num_ngrams[n - 2];  // previous order
+                    }
+
+                    word_id left = ptr[N - n - 1];
+                    if (m_tmp_stats.update(n, left, right)) {
+                        ++m_tmp_data.probs_offsets[n][right];
+                    }
+                }
+
+                if (!ptr.equal_to(prev_ptr, 0, N - 1)) ++m_num_ngrams[N - 2];
+
+                // N-gram case: they do not have modified counts,
+                // rather their counts are equal to the occurrence in corpus
+                uint64_t count = *(ptr.value(N));
+                assert(count > 0);
+                m_total_num_words += count;
+                if (count <= 4) ++m_tmp_stats.t[N - 1][count - 1];
+                prev_ptr = ptr;
+            }
+        }
+
+        /*
+            The tasks of the different orders count into locals, added
+            to m_num_ngrams once per block: its slots share cache lines.
+        */
+        template <typename Iterator, typename Pointer>
+        void scan_left_extensions(uint64_t n, Iterator it, size_t len,
+                                  Pointer prev_ptr) {
+            uint64_t N = m_config.max_order;
+            uint64_t num_ngrams = 0;  // of the previous order
+            for (size_t i = 0; i < len; ++i, ++it) {
+                auto ptr = *it;
+                bool context_changes = !ptr.equal_to(prev_ptr, N - n, N - 1);
+                if (n != 1 and context_changes) {
+                    m_tmp_stats.combine(n);
+                    ++num_ngrams;
+                }
+                word_id right = ptr[N - 1];
+                word_id left = ptr[N - n - 1];
+                if (m_tmp_stats.update(n, left, right)) {
+                    ++m_tmp_data.probs_offsets[n][right];
+                }
+                prev_ptr = ptr;
+            }
+            if (n != 1) m_num_ngrams[n - 2] += num_ngrams;
+        }
+
+        template <typename Iterator, typename Pointer>
+        void scan_counts(Iterator it, size_t len, Pointer prev_ptr) {
+            uint64_t N = m_config.max_order;
+            uint64_t num_ngrams = 0;  // of order N - 1
+            uint64_t num_words = 0;
+            for (size_t i = 0; i < len; ++i, ++it) {
+                auto ptr = *it;
+                if (!ptr.equal_to(prev_ptr, 0, N - 1)) ++num_ngrams;
+
+                // N-gram case: they do not have modified counts,
+                // rather their counts are equal to the occurrence in corpus
+                uint64_t count = *(ptr.value(N));
+                assert(count > 0);
+                num_words += count;
+                if (count <= 4) ++m_tmp_stats.t[N - 1][count - 1];
+                prev_ptr = ptr;
+            }
+            m_num_ngrams[N - 2] += num_ngrams;
+            m_total_num_words += num_words;
+        }
+
         float& D(uint64_t n, uint64_t k) {
             assert(k > 0);
             assert(n >= 1 and n <= m_config.max_order);
@@ -44,12 +44,21 @@ struct async_ngrams_file_source {
     void close_and_remove() {
         close();
         std::remove(m_filename.c_str());
+        tmp_files::removed(m_filename);
     }
 
     size_t size() const {
         return m_buffer.size();
     }
 
+    std::string const& filename() const {
+        return m_filename;
+    }
+
+    size_t file_size() const {
+        return m_file_size;
+    }
+
     bool empty() const {
         return m_buffer.empty();
     }
@@ -82,6 +91,10 @@ struct uncompressed_stream_generator
     uncompressed_stream_generator(uint8_t ngram_order)
         : m_read_bytes(0), m_N(ngram_order), m_eos(false), m_I_time(0.0) {}
 
+    ~uncompressed_stream_generator() {
+        util::wait(m_handle_ptr);  // prefetch uses [fetch]
+    }
+
     void open(std::string const& filename) {
         async_ngrams_file_source::open(filename);
     }
@@ -100,18 +113,17 @@ struct uncompressed_stream_generator
         return m_I_time;
     }
 
+    size_t read_bytes() const {
+        return m_read_bytes;
+    }
+
     bool eos() const {
         return m_eos;
     }
 
-private:
-    size_t m_read_bytes;
-    uint8_t m_N;
-    bool m_eos;
-    double m_I_time;
-
-    std::function<void(size_t)> fetch = [&](size_t bytes) {
-        if (eos()) return;
+    // read the next block without buffering it: must not be at eos
+    block_type read_block(size_t bytes) {
+        assert(!eos());
         auto s = clock_type::now();
         block_type block(m_N);
         if (m_read_bytes + bytes >= m_file_size) {
@@ -124,10 +136,21 @@ private:
         char* begin = block.initialize_memory(bytes);
         block.read_bytes(m_is, begin, bytes);
         block.materialize_index(num_ngrams);
-        m_buffer.push_back(std::move(block));
         auto e = clock_type::now();
         std::chrono::duration<double> elapsed = e - s;
         m_I_time += elapsed.count();
+        return block;
+    }
+
+private:
+    size_t m_read_bytes;
+    uint8_t m_N;
+    bool m_eos;
+    double m_I_time;
+
+    std::function<void(size_t)> fetch = [&](size_t bytes) {
+        if (eos()) return;
+        m_buffer.push_back(read_block(bytes));
     };
 };
 
@@ -145,6 +168,10 @@ struct compressed_stream_generator
         , m_eos(false)
         , m_I_time(0.0) {}
 
+    ~compressed_stream_generator() {
+        util::wait(m_handle_ptr);  // prefetch uses [fetch]
+    }
+
     void open(std::string const& filename) {
         async_ngrams_file_source::open(filename);
         essentials::load_pod(m_is, m_w);
@@ -165,26 +192,25 @@ struct compressed_stream_generator
         return m_I_time;
     }
 
+    size_t read_bytes() const {
+        return m_read_bytes;
+    }
+
     bool eos() const {
         return m_eos;
     }
 
-private:
-    size_t m_read_bytes;
-    uint8_t m_N;
-    uint8_t m_w;
-    uint8_t m_v;
-    bool m_eos;
-    double m_I_time;
-
-    std::function<void(void)> fetch = [&]() {
-        if (eos()) return;
+    // read the next block without buffering it: must not be at eos
+    block_type read_block(size_t /*num_bytes*/) {
+        assert(!eos());
         auto s = clock_type::now();
         size_t size = 0;
         essentials::load_pod(m_is, size);
         m_read_bytes += sizeof(size);
         assert(size > 0);
         block_type block(m_N, size, m_w, m_v);
+        block.read_back(m_is);
+        m_read_bytes += ngrams_block::record_size(m_N);
         size_t bytes = fc::BLOCK_BYTES;
         if (m_read_bytes + bytes >= m_file_size) {
             bytes = m_file_size - m_read_bytes;
@@ -192,28 +218,164 @@ private:
         }
         m_read_bytes += bytes;
         block.read(m_is, bytes);
-        m_buffer.push_back(std::move(block));
         auto e = clock_type::now();
         std::chrono::duration<double> elapsed = e - s;
         m_I_time += elapsed.count();
+        return block;
+    }
+
+private:
+    size_t m_read_bytes;
+    uint8_t m_N;
+    uint8_t m_w;
+    uint8_t m_v;
+    bool m_eos;
+    double m_I_time;
+
+    std::function<void(void)> fetch = [&]() {
+        if (eos()) return;
+        m_buffer.push_back(read_block(0));
     };
 };
 
+/*
+    Serves sorted blocks kept in memory with the same interface as the
+    generators above, when all the runs fit in RAM and no temporary file
+    is written. The blocks handed out are views over the source blocks:
+    each source is freed as soon as all the views over it are released.
+*/
+struct memory_stream_generator {
+    typedef uncompressed_block_type block_type;
+
+    memory_stream_generator() {}
+
+    memory_stream_generator(uint8_t ngram_order)
+        : m_N(ngram_order)
+        , m_record_size(ngrams_block::record_size(ngram_order))
+        , m_source(0)
+        , m_pos(0)
+        , m_read_bytes(0)
+        , m_eos(true) {}
+
+    // take ownership of the blocks
+    void open(std::deque<block_type>& blocks) {
+        m_sources.swap(blocks);
+        m_source = 0;
+        m_pos = 0;
+        m_eos = m_sources.empty();
+    }
+
+    void close() {
+        m_buffer.clear();
+        m_consumed.clear();
+        m_sources.clear();
+    }
+
+    void async_fetch_next_block(size_t num_bytes) {
+        fetch_next_block(num_bytes);
+    }
+
+    void fetch_next_block(size_t num_bytes) {
+        if (eos()) return;
+        uint64_t n = num_bytes / m_record_size;
+        assert(n > 0);
+        block_type view(m_N);
+        view.reserve_index(n);
+        uint64_t consumed = 0;  // sources that this view finishes
+        while (n and m_source != m_sources.size()) {
+            auto& source = m_sources[m_source];
+            uint64_t end = std::min<uint64_t>(source.size(), m_pos + n);
+            for (uint64_t i = m_pos; i != end; ++i) view.push_back(source[i]);
+            n -= end - m_pos;
+            m_pos = end;
+            if (m_pos == source.size()) {
+                ++m_source;
+                ++consumed;
+                m_pos = 0;
+            }
+        }
+        m_eos = m_source == m_sources.size();
+        m_read_bytes += view.size() * m_record_size;
+        m_buffer.push_back(std::move(view));
+        m_consumed.push_back(consumed);
+    }
+
+    size_t size() const {
+        return m_buffer.size();
+    }
+
+    bool empty() const {
+        return m_buffer.empty();
+    }
+
+    block_type* get_block() {
+        assert(size());
+        return &m_buffer.front();
+    }
+
+    void release_block() {
+        m_buffer.front().release();
+        m_buffer.pop_front();
+        for (uint64_t i = 0; i != m_consumed.front(); ++i) {
+            m_sources.front().release();
+            m_sources.pop_front();
+            --m_source;
+        }
+        m_consumed.pop_front();
+    }
+
+    double I_time() const {
+        return 0.0;
+    }
+
+    size_t read_bytes() const {
+        return m_read_bytes;
+    }
+
+    bool eos() const {
+        return m_eos;
+    }
+
+private:
+    uint8_t m_N;
+    uint64_t m_record_size;
+    std::deque<block_type> m_sources;
+    uint64_t m_source;  // source of the next record
+    uint64_t m_pos;     // position of the next record in the source
+    size_t m_read_bytes;
+    bool m_eos;
+    std::deque<block_type> m_buffer;
+    std::deque<uint64_t> m_consumed;
+};
+
 struct writer {
     writer(uint8_t order) : m_order(order) {}
 
+    // records are gathered in a buffer, to issue few large writes
     template <typename Iterator>
-    void write_block(std::ofstream& os, Iterator begin, Iterator end, size_t,
+    void write_block(std::ostream& os, Iterator begin, Iterator end, size_t,
                      ngrams_block_statistics const&) {
-        std::streamsize record_size = ngrams_block::record_size(m_order);
+        static constexpr size_t buffer_bytes = 4 * essentials::MiB;
+        size_t record_size = ngrams_block::record_size(m_order);
+        size_t records_per_write = buffer_bytes / record_size;
+        m_buffer.resize(records_per_write * record_size);
+        char* out = m_buffer.data();
+        char* const out_end = m_buffer.data() + m_buffer.size();
         for (auto it = begin; it != end; ++it) {
             auto ptr = *it;
-            os.write(reinterpret_cast<char const*>(ptr.data), record_size);
+            std::memcpy(out, ptr.data, record_size);
+            out += record_size;
+            if (out == out_end) {
+                os.write(m_buffer.data(), out - m_buffer.data());
+                out = m_buffer.data();
+            }
         }
+        os.write(m_buffer.data(), out - m_buffer.data());
     }
 
 private:
     uint8_t m_order;
+    std::vector<char> m_buffer;
 };
 
 template <typename T = uint16_t>
@@ -2,7 +2,11 @@
 
 #include "ngrams_block.hpp"
 #include "vocabulary.hpp"
+#include "progress.hpp"
+#include "tmp_usage.hpp"
+#include "tmp_reclaimer.hpp"
 
+#include <deque>
 #include <vector>
 
 namespace tongrams {
@@ -33,7 +37,7 @@ struct statistics {
 
     void release(uint64_t n) {
         assert(n > 0);
-        stats[n - 1].resize(0, {invalid_range_id, invalid_word_id});
+        std::vector<word_statistic>().swap(stats[n - 1]);
     }
 
     void resize(uint64_t n, size_t vocab_size) {
@@ -130,13 +134,18 @@ struct statistics {
 };
 
 struct data {
-    data() : vocab_builder(0) {
+    data() : vocab_builder(0), reclaimer(tmp_usage) {
         word_ids.set_empty_key(constants::invalid_hash);
         assert(vocab_builder.size() == 0);
     }
 
     words_map word_ids;  // map from unigrams' hashes to word ids
 
+    // clear() keeps the buckets of a dense_hash_map: swap them away
+    void release_word_ids() {
+        words_map().swap(word_ids);
+    }
+
     vocabulary::builder vocab_builder;
 
     /*
@@ -151,6 +160,27 @@ struct data {
         Each block corresponds to a partition of the total N-grams file.
     */
     std::vector<std::vector<uint64_t>> blocks_offsets;
+
+    /*
+        Sorted runs and merged blocks, when they all fit in RAM:
+        in this case no run file (.c) nor merged file (.m) is written.
+    */
+    std::deque<ngrams_block> counts_blocks;
+    std::deque<ngrams_block> merged_blocks;
+
+    // N-grams written to the run files (.c), to size the merged file
+    uint64_t num_run_ngrams = 0;
+
+    // the run files (.c) written by this process, in order: only these are
+    // merged, whatever else the temporary directory holds
+    std::vector<std::string> run_filenames;
+
+    // the merged file (.m) written by the adjusting step, if any
+    std::string merged_filename;
+
+    progress_reporter progress;
+    tmp_space_usage tmp_usage;
+    tmp_reclaimer reclaimer;  // must follow tmp_usage
 };
 
 }  // namespace tmp
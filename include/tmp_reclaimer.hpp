@@ -0,0 +1,94 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tmp_usage.hpp"
+
+namespace tongrams {
+
+/*
+    Removes temporary files on a background thread, so that the merge and
+    the construction of the index never wait for the file system.
+    Unlinking a multi-GB file at once can stall for seconds on some file
+    systems: the file is first shrunk from the end in chunks, so that the
+    space is given back progressively, and then unlinked.
+    Files still queued at destruction are removed before returning.
+*/
+struct tmp_reclaimer {
+    static constexpr off_t chunk_bytes = 256 * essentials::MiB;
+
+    tmp_reclaimer(tmp_space_usage& usage)
+        : m_usage(usage)
+        , m_stop(false)
+        , m_thread(&tmp_reclaimer::run, this) {}
+
+    ~tmp_reclaimer() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+    }
+
+    // the file must not be open for reading or writing anymore
+    void remove(std::string const& filename) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.push_back(filename);
+        }
+        m_cv.notify_one();
+    }
+
+private:
+    tmp_space_usage& m_usage;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::string> m_queue;
+    bool m_stop;
+    std::thread m_thread;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait(lock, [&] { return m_stop or !m_queue.empty(); });
+            if (m_queue.empty()) return;  // stopped and drained
+            std::string filename = std::move(m_queue.front());
+            m_queue.pop_front();
+            lock.unlock();
+            reclaim(filename);
+            lock.lock();
+        }
+    }
+
+    void reclaim(std::string const& filename) {
+        int fd = ::open(filename.c_str(), O_WRONLY);
+        if (fd != -1) {
+            struct stat st;
+            if (::fstat(fd, &st) == 0) {
+                off_t size = st.st_size;
+                while (size > 0) {
+                    off_t freed = size > chunk_bytes ? chunk_bytes : size;
+                    if (::ftruncate(fd, size - freed) != 0) break;
+                    size -= freed;
+                    m_usage.sub(freed);
+                }
+                if (size > 0) m_usage.sub(size);  // freed by the unlink
+            }
+            ::close(fd);
+        }
+        std::remove(filename.c_str());
+        tmp_files::removed(filename);
+    }
+};
+
+}  // namespace tongrams
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "configuration.hpp"
+#include "ngrams_block.hpp"
+
+namespace tongrams {
+
+/*
+    Bytes currently occupied by temporary files, as they are written,
+    merged and removed by the different steps.
+    If a limit is set and the usage exceeds it, check() throws.
+*/
+struct tmp_space_usage {
+    tmp_space_usage() : m_limit(0), m_bytes(0), m_peak(0) {}
+
+    void set_limit(uint64_t bytes) {
+        m_limit = bytes;
+    }
+
+    void add(uint64_t bytes) {
+        uint64_t current = m_bytes.fetch_add(bytes) + bytes;
+        uint64_t peak = m_peak.load();
+        while (current > peak and !m_peak.compare_exchange_weak(peak, current))
+            ;
+    }
+
+    void sub(uint64_t bytes) {
+        m_bytes.fetch_sub(bytes);
+    }
+
+    bool exceeded() const {
+        return m_limit and m_bytes.load() > m_limit;
+    }
+
+    void check() const {
+        if (exceeded()) {
+            throw std::runtime_error(
+                "temporary files take " + std::to_string(m_bytes.load()) +
+                " bytes, exceeding the limit of " + std::to_string(m_limit) +
+                " bytes given with --tmp_limit: try with --compress_blocks "
+                "or a larger limit");
+        }
+    }
+
+    uint64_t bytes() const {
+        return m_bytes.load();
+    }
+
+    uint64_t peak() const {
+        return m_peak.load();
+    }
+
+private:
+    uint64_t m_limit;
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_peak;
+};
+
+struct tmp_footprint {
+    uint64_t runs;    // sorted runs written by counting
+    uint64_t merged;  // merged file written by adjusting
+
+    uint64_t peak() const {
+        // runs are removed only once merged
+        return runs + merged;
+    }
+};
+
+/*
+    Rough estimate of the temporary disk space needed, computed from the
+    corpus size before reading it: each token produces at most one new
+    N-gram record in the sorted runs, and merging does not produce more
+    records than the runs have.
+*/
+tmp_footprint estimate_tmp_footprint(configuration const& config,
+                                     bool compress_blocks,
+                                     bool merged_in_tmp) {
+    static constexpr double avg_bytes_per_token = 6.0;  // including separator
+    static constexpr double compression_ratio = 0.4;    // front coding
+    uint64_t num_tokens = config.text_size / avg_bytes_per_token;
+    uint64_t bytes =
+        (num_tokens + config.max_order) *
+        ngrams_block::record_size(static_cast<uint8_t>(config.max_order));
+    tmp_footprint f;
+    f.runs = compress_blocks ? bytes * compression_ratio : bytes;
+    f.merged = merged_in_tmp ? bytes : 0;
+    return f;
+}
+
+/*
+    Compare the estimate against the free space in the temporary directory
+    and the limit given with --tmp_limit: switch to compressed runs if they
+    would fit while uncompressed would not.
+*/
+void preflight_tmp_space(configuration& config, bool merged_in_tmp) {
+    auto f = estimate_tmp_footprint(config, config.compress_blocks,
+                                    merged_in_tmp);
+    uint64_t available =
+        boost::filesystem::space(boost::filesystem::path(config.tmp_dirname))
+            .available;
+    std::cerr << "estimated peak of temporary files: " << f.peak()
+              << " bytes (" << available << " bytes available in '"
+              << config.tmp_dirname << "')" << std::endl;
+
+    uint64_t limit = config.tmp_limit ? std::min(config.tmp_limit, available)
+                                      : available;
+    if (f.peak() <= limit) return;
+
+    if (!config.compress_blocks) {
+        auto c = estimate_tmp_footprint(config, true, merged_in_tmp);
+        if (c.peak() <= limit) {
+            std::cerr << "switching to compressed temporary files: estimated "
+                         "peak is "
+                      << c.peak() << " bytes" << std::endl;
+            config.compress_blocks = true;
+            return;
+        }
+    }
+
+    std::cerr << "Warning: temporary files may need more than the "
+              << limit << " bytes "
+              << (config.tmp_limit ? "allowed with --tmp_limit"
+                                   : "available")
+              << (config.tmp_limit ? ": the run will stop as soon as the "
+                                     "limit is exceeded"
+                                   : "")
+              << std::endl;
+}
+
+}  // namespace tongrams
@@ -2,13 +2,22 @@
 
 #include "../external/tongrams/include/utils/iterators.hpp"
 #include "../external/tongrams/include/utils/util_types.hpp"
+#include "util_types.hpp"
 
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/filesystem.hpp>
 
 #include <sys/mman.h>  // for POSIX_MADV_SEQUENTIAL and POSIX_MADV_RANDOM
+#include <unistd.h>
+#include <ctime>
 #include <thread>
 #include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#ifdef __GLIBC__
+#include <malloc.h>  // for malloc_trim
+#endif
 
 namespace tongrams::util {
 
@@ -17,6 +26,14 @@ void write(std::ofstream& os, byte_range br) {
              (br.second - br.first) * sizeof(char));
 }
 
+// same format as essentials::logger, but on std::cerr: std::cout carries
+// the JSON metrics
+void logger(std::string const& msg) {
+    std::time_t t = std::time(nullptr);
+    std::cerr << std::put_time(std::localtime(&t), "%F %T") << ": " << msg
+              << std::endl;
+}
+
 size_t file_size(const char* filename) {
     boost::filesystem::path filepath(filename);
     return boost::filesystem::file_size(filepath);
@@ -63,6 +80,11 @@ void clean_temporaries(std::string const& tmp_dirname) {
     boost::filesystem::remove_all(boost::filesystem::path(tmp_dirname.c_str()));
 }
 
+// remove only the files we created, since the directory may be shared
+void remove_temporaries() {
+    tmp_files::remove_all();
+}
+
 template <typename Funct, typename... Args>
 auto async_call(Funct& f, Args&&... args) {
     return std::make_unique<std::thread>(f, args...);
@@ -72,4 +94,20 @@ void wait(std::unique_ptr<std::thread>& handle_ptr) {
     if (handle_ptr and handle_ptr->joinable()) handle_ptr->join();
 }
 
+// resident set size of the process, in bytes
+uint64_t resident_set_size() {
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    if (!(statm >> size >> resident)) return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// give the memory freed so far back to the OS: large vectors freed in a
+// step may otherwise stay in the allocator's arenas during the next one
+void trim_memory() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
 }  // namespace tongrams::util
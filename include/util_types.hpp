@@ -1,7 +1,13 @@
 #pragma once
 
+#include <cassert>
+#include <cstdio>
+#include <condition_variable>
 #include <deque>
+#include <exception>
 #include <mutex>
+#include <set>
+#include <string>
 #include <thread>
 #include <chrono>
 #include <vector>
@@ -19,7 +25,11 @@
 namespace tongrams {
 
 typedef uint32_t ngram_id;
+#ifdef TONGRAMS_WORD_ID_16
+typedef uint16_t word_id;  // halves records for vocabularies < 65535 words
+#else
 typedef uint32_t word_id;
+#endif
 typedef uint32_t range_id;
 typedef uint32_t occurrence;
 typedef uint64_t count_type;
@@ -104,68 +114,136 @@ private:
     std::string m_cur_filename;
 };
 
-template <typename T>
-struct semi_sync_queue {
-    semi_sync_queue() {
-        open();
+/*
+    Temporary files created by this process, so that a failed run removes
+    them without touching those of other runs sharing the directory.
+*/
+struct tmp_files {
+    static void created(std::string const& filename) {
+        std::lock_guard<std::mutex> lock(mutex());
+        names().insert(filename);
     }
 
-    void close() {
-        m_open = false;
+    static void removed(std::string const& filename) {
+        std::lock_guard<std::mutex> lock(mutex());
+        names().erase(filename);
     }
 
-    void open() {
-        m_open = true;
+    static void remove_all() {
+        std::lock_guard<std::mutex> lock(mutex());
+        for (auto const& filename : names()) std::remove(filename.c_str());
+        names().clear();
     }
 
-    void lock() {
-        m_mutex.lock();
+private:
+    static std::mutex& mutex() {
+        static std::mutex m;
+        return m;
     }
 
-    void unlock() {
-        m_mutex.unlock();
+    static std::set<std::string>& names() {
+        static std::set<std::string> s;
+        return s;
+    }
+};
+
+/*
+    Bounded channel between two pipeline stages: the producer pushes items,
+    the consumer thread takes them in order. An item is pending from push()
+    until the consumer is done with it (pop()), and push() blocks while
+    [capacity] items are pending: back-pressure keeps at most that many
+    items in flight. Both sides sleep, instead of spinning, while they
+    cannot proceed, leaving the cores to the stages that can.
+    An exception thrown on the consumer thread is stored and rethrown on
+    the producer thread.
+*/
+template <typename T>
+struct channel {
+    channel(size_t capacity = 1)
+        : m_capacity(capacity), m_open(true), m_aborted(false) {
+        assert(capacity > 0);
     }
 
     void push(T& val) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(lock, [&] {
+            return m_buffer.size() < m_capacity or m_aborted;
+        });
+        if (m_error) std::rethrow_exception(m_error);
         m_buffer.push_back(std::move(val));
+        m_not_empty.notify_one();
     }
 
-    T& pick() {
-        return m_buffer.front();
+    // the next item, or nullptr if the channel is closed and drained, or
+    // aborted
+    T* front() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [&] {
+            return !m_buffer.empty() or !m_open or m_aborted;
+        });
+        if (m_buffer.empty() or m_aborted) return nullptr;
+        return &m_buffer.front();
     }
 
+    // the consumer is done with the front item
     void pop() {
+        std::lock_guard<std::mutex> lock(m_mutex);
         m_buffer.pop_front();
+        m_not_full.notify_one();
     }
 
-    bool active() const {
-        return m_open;
+    // no more items: the consumer takes those pending, then stops
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_open = false;
+        m_not_empty.notify_all();
     }
 
-    bool empty() const {
-        return m_buffer.empty();
+    // stop the consumer now, leaving the pending items
+    void abort() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_open = false;
+        m_aborted = true;
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
     }
 
-    size_t size() const {
-        return m_buffer.size();
+    // the consumer failed with [error]: stop it and hand the error over to
+    // the producer, which gets it from its next push() or from check()
+    void fail(std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = error;
+        m_open = false;
+        m_aborted = true;
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
     }
 
-    auto begin() {
-        return m_buffer.begin();
+    // rethrow the error of the consumer, if any
+    void check() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_error) std::rethrow_exception(m_error);
     }
 
-    auto end() {
-        return m_buffer.end();
+    bool empty() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_buffer.empty();
     }
 
-    void release() {
-        std::deque<T>().swap(m_buffer);
+    size_t size() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_buffer.size();
     }
 
 private:
+    size_t m_capacity;
+    bool m_open;
+    bool m_aborted;
     std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
     std::deque<T> m_buffer;
-    bool m_open;
+    std::exception_ptr m_error;
 };
 
 }  // namespace tongrams
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Builds models from the sample text with several estimate configurations
+# and benchmarks each of them with query_benchmark. For every configuration,
+# results/<config>.json holds the metrics of the build ("build") and of the
+# queries ("query").
+#
+# Usage: query_benchmarks.sh <build_dir> <text> <results_dir> [num_queries]
+
+set -e -o pipefail
+
+if [ $# -lt 3 ]; then
+    echo "usage: $0 <build_dir> <text> <results_dir> [num_queries]" >&2
+    exit 1
+fi
+
+build_dir=$1
+text=$2
+results_dir=$3
+num_queries=${4:-1000000}
+
+if [ ! -f "$text" ] && [ -f "$text.gz" ]; then
+    gunzip -k "$text.gz"
+fi
+
+mkdir -p "$results_dir"
+tmp_dir=$(mktemp -d)
+trap 'rm -rf "$tmp_dir"' EXIT
+
+# order, probability bits, backoff bits
+configs="3:8:8 5:8:8 5:4:4 5:12:12"
+
+for c in $configs; do
+    IFS=: read -r order p b <<< "$c"
+    name="order${order}_p${p}_b${b}"
+    index="$tmp_dir/$name.bin"
+    echo "== $name" >&2
+    # the metrics are the JSON line of stdout: anything else is a log
+    build=$("$build_dir/estimate" "$text" "$order" --tmp "$tmp_dir" \
+        --ram 0.25 --p "$p" --b "$b" --out "$index" | grep '^{' | tail -n 1)
+    query=$("$build_dir/query_benchmark" "$index" "$text" \
+        --queries "$num_queries" | grep '^{' | tail -n 1)
+    echo "{\"config\":\"$name\", \"build\":$build, \"query\":$query}" \
+        > "$results_dir/$name.json"
+    rm -f "$index"
+done
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <iostream>
+
+#include "../external/tongrams/external/cmd_line_parser/include/parser.hpp"
+
+#include "util.hpp"
+#include "util_types.hpp"
+#include "scoring.hpp"
+
+int main(int argc, char** argv) {
+    using namespace tongrams;
+
+    cmd_line_parser::parser parser(argc, argv);
+    parser.add("index_filename",
+               "Index built by estimate (binary file, e.g. 'index.bin').");
+    parser.add("corpus_filename",
+               "Text to score: one sentence per line, words separated by "
+               "spaces.");
+    parser.add("num_threads",
+               "Number of threads. Default is " +
+                   std::to_string(std::thread::hardware_concurrency()) +
+                   " on this machine.",
+               "--thr", false);
+    if (!parser.parse()) return 1;
+
+    auto index_filename = parser.get<std::string>("index_filename");
+    auto corpus_filename = parser.get<std::string>("corpus_filename");
+    uint64_t num_threads = std::thread::hardware_concurrency();
+    if (parser.parsed("num_threads")) {
+        num_threads = parser.get<uint64_t>("num_threads");
+        if (num_threads == 0) {
+            std::cerr << "number of threads must be > 0" << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        util::logger("loading index");
+        reversed_trie_index model;
+        load_index(model, index_filename);
+
+        scoring::corpus text(corpus_filename);
+        auto shards = text.shards(num_threads);
+        std::vector<scoring::score_stats> shard_stats(shards.size());
+
+        util::logger("scoring " + std::to_string(shards.size()) + " shards");
+        auto start = clock_type::now();
+        {
+            parallel_executor p(shards.size());
+            task_region(*(p.executor), [&](task_region_handle& trh) {
+                for (uint64_t i = 0; i != shards.size(); ++i) {
+                    trh.run([&, i] {
+                        shard_stats[i] = scoring::score(model, shards[i]);
+                    });
+                }
+            });
+        }
+        auto end = clock_type::now();
+        std::chrono::duration<double> elapsed = end - start;
+
+        scoring::score_stats stats;
+        for (auto const& s : shard_stats) stats += s;
+
+        std::cout << "{";
+        std::cout << "\"corpus\":"
+                  << boost::filesystem::path(corpus_filename).stem() << ", ";
+        std::cout << "\"threads\":" << shards.size() << ", ";
+        std::cout << "\"sentences\":" << stats.sentences << ", ";
+        std::cout << "\"tokens\":" << stats.tokens << ", ";
+        std::cout << "\"OOVs\":" << stats.OOVs << ", ";
+        std::cout << "\"log10_prob\":" << stats.log10_prob << ", ";
+        std::cout << "\"perplexity\":" << stats.perplexity() << ", ";
+        std::cout << "\"time\":" << elapsed.count() << ", ";
+        std::cout << "\"tokens_per_sec\":" << stats.tokens / elapsed.count();
+        std::cout << "}" << std::endl;
+    } catch (std::exception const& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include "../external/tongrams/external/cmd_line_parser/include/parser.hpp"
+
+#include "util.hpp"
+#include "util_types.hpp"
+#include "scoring.hpp"
+
+using namespace tongrams;
+
+template <typename Model>
+double score_queries(Model& model, std::vector<scoring::query> const& queries) {
+    typename Model::state_type state(model.order());
+    double log10_prob = 0.0;
+    for (auto const& q : queries) {
+        state.init();
+        for (auto word : q) {
+            bool is_OOV = false;
+            log10_prob += model.score(state, word, is_OOV);
+        }
+    }
+    return log10_prob;
+}
+
+// one query at a time, in the given order
+void benchmark_lookups(reversed_trie_index& model,
+                       std::vector<scoring::query> const& queries,
+                       char const* name) {
+    auto start = clock_type::now();
+    double checksum = score_queries(model, queries);
+    auto end = clock_type::now();
+    std::chrono::duration<double> elapsed = end - start;
+    double total = elapsed.count();
+    std::cout << "\"" << name << "\":{";
+    std::cout << "\"ns_per_query\":" << total * 1e9 / queries.size() << ", ";
+    std::cout << "\"queries_per_sec\":" << queries.size() / total << ", ";
+    std::cout << "\"checksum\":" << checksum;
+    std::cout << "}";
+    std::cerr << name << " lookups: " << total * 1e9 / queries.size()
+              << " [ns/query]" << std::endl;
+}
+
+// throughput of scoring whole sentences, carrying the state along each line
+void benchmark_sentences(reversed_trie_index& model, byte_range text) {
+    auto start = clock_type::now();
+    auto stats = scoring::score(model, text);
+    auto end = clock_type::now();
+    std::chrono::duration<double> elapsed = end - start;
+    double total = elapsed.count();
+    std::cout << "\"sentences\":{";
+    std::cout << "\"sentences\":" << stats.sentences << ", ";
+    std::cout << "\"tokens\":" << stats.tokens << ", ";
+    std::cout << "\"OOVs\":" << stats.OOVs << ", ";
+    std::cout << "\"perplexity\":" << stats.perplexity() << ", ";
+    std::cout << "\"tokens_per_sec\":" << stats.tokens / total;
+    std::cout << "}";
+    std::cerr << "sentences: " << stats.tokens / total << " [tokens/sec]"
+              << std::endl;
+}
+
+/*
+    Rescoring-style workload: each sentence of the text yields [beam]
+    hypotheses, its prefixes of decreasing length, which share most of
+    their contexts. They are scored with and without a context cache.
+*/
+void benchmark_rescoring(reversed_trie_index& model, byte_range text,
+                         uint64_t num_sentences, uint64_t beam,
+                         uint64_t cache_capacity) {
+    std::vector<scoring::query> hypotheses;
+    scoring::query sentence;
+    uint64_t sentences = 0;
+    scoring::for_each_word(
+        text, [&](byte_range word) { sentence.push_back(word); },
+        [&] {
+            if (sentences++ < num_sentences) {
+                for (uint64_t j = 0; j != beam and j != sentence.size(); ++j) {
+                    hypotheses.emplace_back(sentence.begin(),
+                                            sentence.end() - j);
+                }
+            }
+            sentence.clear();
+        });
+    uint64_t words = 0;
+    for (auto const& h : hypotheses) words += h.size();
+
+    auto start = clock_type::now();
+    double plain = score_queries(model, hypotheses);
+    auto end = clock_type::now();
+    std::chrono::duration<double> plain_time = end - start;
+
+    scoring::cached_model<reversed_trie_index> cached(model, cache_capacity);
+    start = clock_type::now();
+    double with_cache = score_queries(cached, hypotheses);
+    end = clock_type::now();
+    std::chrono::duration<double> cached_time = end - start;
+
+    std::cout << "\"rescoring\":{";
+    std::cout << "\"hypotheses\":" << hypotheses.size() << ", ";
+    std::cout << "\"words\":" << words << ", ";
+    std::cout << "\"cache_capacity\":" << cache_capacity << ", ";
+    std::cout << "\"ns_per_word\":" << plain_time.count() * 1e9 / words
+              << ", ";
+    std::cout << "\"cached_ns_per_word\":"
+              << cached_time.count() * 1e9 / words << ", ";
+    std::cout << "\"hit_rate\":" << cached.hit_rate() << ", ";
+    std::cout << "\"model_lookups_per_word\":"
+              << double(cached.lookups()) / words << ", ";
+    std::cout << "\"replayed_lookups\":" << cached.replayed() << ", ";
+    std::cout << "\"checksum\":" << plain << ", ";
+    std::cout << "\"cached_checksum\":" << with_cache;
+    std::cout << "}";
+    std::cerr << "rescoring: " << plain_time.count() * 1e9 / words
+              << " [ns/word]; with cache: "
+              << cached_time.count() * 1e9 / words << " [ns/word] (hit rate "
+              << cached.hit_rate() << ", " << double(cached.lookups()) / words
+              << " model lookups per word)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    cmd_line_parser::parser parser(argc, argv);
+    parser.add("index_filename",
+               "Index built by estimate (binary file, e.g. 'index.bin').");
+    parser.add("corpus_filename",
+               "Text from which the queries are taken: its N-grams, where N "
+               "is the order of the index.");
+    parser.add("num_queries",
+               "Number of queries. Default is 1000000.", "--queries", false);
+    parser.add("seed", "Seed for shuffling the queries. Default is 13.",
+               "--seed", false);
+    parser.add("cache",
+               "Also benchmark n-best rescoring of the first sentences of the "
+               "text, with a context cache of this many entries. Default is "
+               "no rescoring benchmark.",
+               "--cache", false);
+    if (!parser.parse()) return 1;
+
+    auto index_filename = parser.get<std::string>("index_filename");
+    auto corpus_filename = parser.get<std::string>("corpus_filename");
+    uint64_t num_queries = 1000000;
+    if (parser.parsed("num_queries")) {
+        num_queries = parser.get<uint64_t>("num_queries");
+    }
+    uint64_t seed = 13;
+    if (parser.parsed("seed")) seed = parser.get<uint64_t>("seed");
+    uint64_t cache_capacity = 0;
+    if (parser.parsed("cache")) cache_capacity = parser.get<uint64_t>("cache");
+
+    try {
+        util::logger("loading index");
+        reversed_trie_index model;
+        load_index(model, index_filename);
+
+        scoring::corpus text(corpus_filename);
+        auto queries =
+            scoring::ngrams(text.text(), model.order(), num_queries);
+        if (queries.empty()) {
+            std::cerr << "Error: no queries in corpus" << std::endl;
+            return 1;
+        }
+        util::logger("benchmarking " + std::to_string(queries.size()) +
+                     " queries");
+
+        std::cout << "{";
+        std::cout << "\"index\":"
+                  << boost::filesystem::path(index_filename).stem() << ", ";
+        std::cout << "\"index_bytes\":"
+                  << util::file_size(index_filename.c_str()) << ", ";
+        std::cout << "\"order\":" << model.order() << ", ";
+        std::cout << "\"queries\":" << queries.size() << ", ";
+        benchmark_sentences(model, text.text());
+        std::cout << ", \"lookups\":{";
+        benchmark_lookups(model, queries, "sequential");
+        std::shuffle(queries.begin(), queries.end(), std::mt19937_64(seed));
+        std::cout << ", ";
+        benchmark_lookups(model, queries, "random");
+        std::cout << "}";
+        if (cache_capacity) {
+            std::cout << ", ";
+            benchmark_rescoring(model, text.text(), 10000, 8, cache_capacity);
+        }
+        std::cout << "}" << std::endl;
+    } catch (std::exception const& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
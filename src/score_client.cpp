@@ -0,0 +1,194 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+
+#include "../external/tongrams/external/cmd_line_parser/include/parser.hpp"
+
+#include "util.hpp"
+#include "util_types.hpp"
+#include "scoring.hpp"
+
+using namespace tongrams;
+
+/*
+    Load generator for score_server: [num_connections] clients send the
+    lines of a text as requests, each keeping up to [pipeline] requests in
+    flight, and measure the latency of every request.
+*/
+int connect_to(std::string const& socket_path) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        throw std::runtime_error("socket: " +
+                                 std::string(std::strerror(errno)));
+    }
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+        int e = errno;
+        ::close(fd);
+        throw std::runtime_error("cannot connect to '" + socket_path +
+                                 "': " + std::strerror(e));
+    }
+    return fd;
+}
+
+void send_all(int fd, std::string const& s) {
+    char const* p = s.data();
+    size_t left = s.size();
+    while (left) {
+        ssize_t w = ::send(fd, p, left, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("send: " +
+                                     std::string(std::strerror(errno)));
+        }
+        p += w;
+        left -= w;
+    }
+}
+
+// latencies, in microseconds, of the requests sent on one connection
+std::vector<double> run_client(std::string const& socket_path,
+                               std::vector<std::string> const& requests,
+                               uint64_t first, uint64_t step,
+                               uint64_t pipeline) {
+    int fd = connect_to(socket_path);
+    std::vector<double> latencies;
+    std::deque<clock_type::time_point> in_flight;
+    std::vector<char> chunk(64 * essentials::KiB);
+    uint64_t next = first;
+    while (next < requests.size() or !in_flight.empty()) {
+        while (next < requests.size() and in_flight.size() < pipeline) {
+            in_flight.push_back(clock_type::now());
+            send_all(fd, requests[next]);
+            next += step;
+        }
+        ssize_t r = ::recv(fd, chunk.data(), chunk.size(), 0);
+        if (r < 0 and errno == EINTR) continue;
+        if (r <= 0) throw std::runtime_error("connection closed by server");
+        auto now = clock_type::now();
+        for (ssize_t i = 0; i != r; ++i) {
+            if (chunk[i] != '\n') continue;
+            std::chrono::duration<double, std::micro> elapsed =
+                now - in_flight.front();
+            latencies.push_back(elapsed.count());
+            in_flight.pop_front();
+        }
+    }
+    ::close(fd);
+    return latencies;
+}
+
+int main(int argc, char** argv) {
+    cmd_line_parser::parser parser(argc, argv);
+    parser.add("socket_path", "Unix domain socket of score_server.");
+    parser.add("corpus_filename",
+               "Text whose lines are sent as requests, cyclically.");
+    parser.add("num_requests", "Number of requests. Default is 100000.",
+               "--requests", false);
+    parser.add("num_connections",
+               "Number of concurrent connections. Default is 4.",
+               "--connections", false);
+    parser.add("pipeline",
+               "Requests in flight per connection. Default is 1.",
+               "--pipeline", false);
+    if (!parser.parse()) return 1;
+
+    auto socket_path = parser.get<std::string>("socket_path");
+    auto corpus_filename = parser.get<std::string>("corpus_filename");
+    uint64_t num_requests = 100000;
+    uint64_t num_connections = 4;
+    uint64_t pipeline = 1;
+    if (parser.parsed("num_requests")) {
+        num_requests = parser.get<uint64_t>("num_requests");
+    }
+    if (parser.parsed("num_connections")) {
+        num_connections = parser.get<uint64_t>("num_connections");
+    }
+    if (parser.parsed("pipeline")) pipeline = parser.get<uint64_t>("pipeline");
+    if (num_connections == 0 or pipeline == 0) {
+        std::cerr << "connections and pipeline must be > 0" << std::endl;
+        return 1;
+    }
+
+    try {
+        std::vector<std::string> lines;
+        {
+            scoring::corpus text(corpus_filename);
+            std::string line;
+            scoring::for_each_word(
+                text.text(),
+                [&](byte_range word) {
+                    if (lines.size() == num_requests) return;
+                    if (!line.empty()) line.push_back(' ');
+                    line.append(word.first, word.second);
+                },
+                [&] {
+                    if (lines.size() != num_requests) {
+                        lines.push_back(line + "\n");
+                    }
+                    line.clear();
+                });
+        }
+        if (lines.empty()) {
+            std::cerr << "Error: no lines in corpus" << std::endl;
+            return 1;
+        }
+        std::vector<std::string> requests;
+        requests.reserve(num_requests);
+        for (uint64_t i = 0; i != num_requests; ++i) {
+            requests.push_back(lines[i % lines.size()]);
+        }
+
+        std::vector<std::vector<double>> latencies(num_connections);
+        auto start = clock_type::now();
+        {
+            parallel_executor p(num_connections);
+            task_region(*(p.executor), [&](task_region_handle& trh) {
+                for (uint64_t i = 0; i != num_connections; ++i) {
+                    trh.run([&, i] {
+                        latencies[i] = run_client(socket_path, requests, i,
+                                                  num_connections, pipeline);
+                    });
+                }
+            });
+        }
+        auto end = clock_type::now();
+        std::chrono::duration<double> elapsed = end - start;
+
+        std::vector<double> all;
+        for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+        std::sort(all.begin(), all.end());
+        auto percentile = [&](double p) {
+            return all[static_cast<uint64_t>(p * (all.size() - 1))];
+        };
+        double mean = 0.0;
+        for (auto x : all) mean += x;
+        mean /= all.size();
+
+        std::cout << "{";
+        std::cout << "\"requests\":" << all.size() << ", ";
+        std::cout << "\"connections\":" << num_connections << ", ";
+        std::cout << "\"pipeline\":" << pipeline << ", ";
+        std::cout << "\"requests_per_sec\":" << all.size() / elapsed.count()
+                  << ", ";
+        std::cout << "\"mean_us\":" << mean << ", ";
+        std::cout << "\"p50_us\":" << percentile(0.50) << ", ";
+        std::cout << "\"p99_us\":" << percentile(0.99) << ", ";
+        std::cout << "\"p999_us\":" << percentile(0.999);
+        std::cout << "}" << std::endl;
+    } catch (std::exception const& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <iostream>
+
+#include "../external/tongrams/external/cmd_line_parser/include/parser.hpp"
+
+#include "util.hpp"
+#include "util_types.hpp"
+#include "cancellation.hpp"
+#include "score_server.hpp"
+
+int main(int argc, char** argv) {
+    using namespace tongrams;
+
+    cmd_line_parser::parser parser(argc, argv);
+    parser.add("index_filename",
+               "Index built by estimate (binary file, e.g. 'index.bin').");
+    parser.add("socket_path", "Path of the Unix domain socket to listen on.");
+    parser.add("num_threads",
+               "Number of scoring threads. Default is " +
+                   std::to_string(std::thread::hardware_concurrency()) +
+                   " on this machine.",
+               "--thr", false);
+    parser.add("batch_size",
+               "Maximum number of requests scored together. Default is " +
+                   std::to_string(
+                       score_server<reversed_trie_index>::default_batch_size) +
+                   ".",
+               "--batch", false);
+    parser.add("max_wait",
+               "Under load, wait at most this many microseconds for a batch "
+               "to fill up. Default is 100.",
+               "--max_wait", false);
+    if (!parser.parse()) return 1;
+
+    auto index_filename = parser.get<std::string>("index_filename");
+    auto socket_path = parser.get<std::string>("socket_path");
+    uint64_t num_threads = std::thread::hardware_concurrency();
+    if (parser.parsed("num_threads")) {
+        num_threads = parser.get<uint64_t>("num_threads");
+    }
+    uint64_t batch_size = score_server<reversed_trie_index>::default_batch_size;
+    if (parser.parsed("batch_size")) {
+        batch_size = parser.get<uint64_t>("batch_size");
+    }
+    uint64_t max_wait = 100;
+    if (parser.parsed("max_wait")) max_wait = parser.get<uint64_t>("max_wait");
+    if (num_threads == 0 or batch_size == 0) {
+        std::cerr << "number of threads and batch size must be > 0"
+                  << std::endl;
+        return 1;
+    }
+
+    cancellation::install(10);
+
+    try {
+        util::logger("loading index");
+        reversed_trie_index model;
+        load_index(model, index_filename);
+
+        score_server<reversed_trie_index> server(model, socket_path,
+                                                 num_threads, batch_size,
+                                                 max_wait);
+        util::logger("listening on '" + socket_path + "'");
+        server.run();
+
+        std::cout << "{";
+        server.print_stats();
+        std::cout << "}" << std::endl;
+    } catch (std::exception const& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
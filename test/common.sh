@@ -0,0 +1,59 @@
+# Helpers of the round-trip tests. A test runs the tools of <build_dir> on
+# the first lines of <corpus.gz> and checks that an option gives the same
+# counts or model as the default path.
+#
+# Usage, from a test: source common.sh <build_dir> <corpus.gz> [num_lines]
+
+set -e -o pipefail
+export LC_ALL=C  # the same sort order everywhere
+
+build_dir=$1
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+log="$work_dir/log"
+
+corpus="$work_dir/corpus"
+(gunzip -c "$2" || true) | head -n "${3:-20000}" > "$corpus"
+
+fail() {
+    echo "FAILED: $1" >&2
+    exit 1
+}
+
+# run_count <text> <order> <output> [options]: the number of N-grams,
+# then the counts sorted
+run_count() {
+    local text=$1 order=$2 output=$3
+    shift 3
+    rm -f "$output.raw"  # count appends to its output file
+    "$build_dir/count" "$text" "$order" --tmp "$work_dir/tmp" \
+        --out "$output.raw" "$@" > /dev/null 2> "$log" ||
+        { cat "$log" >&2; fail "count $*"; }
+    { head -n 1 "$output.raw"; tail -n +2 "$output.raw" | sort; } > "$output"
+}
+
+# run_estimate <text> <order> <index> [options]
+run_estimate() {
+    local text=$1 order=$2 index=$3
+    shift 3
+    "$build_dir/estimate" "$text" "$order" --tmp "$work_dir/tmp" \
+        --out "$index" "$@" > /dev/null 2> "$log" ||
+        { cat "$log" >&2; fail "estimate $*"; }
+}
+
+# score <index> <text>: the OOVs and the log10 probability of the text, on
+# one thread so that the sum is always taken in the same order
+score() {
+    "$build_dir/parallel_score" "$1" "$2" --thr 1 > "$work_dir/score" \
+        2> "$log" || { cat "$log" >&2; fail "parallel_score $1"; }
+    grep '^{' "$work_dir/score" | tail -n 1 |
+        sed 's/.*"OOVs":\([^,]*\), "log10_prob":\([^,]*\),.*/\1 \2/'
+}
+
+# same <expected> <actual> <what>
+same() {
+    if ! cmp -s "$1" "$2"; then
+        diff "$1" "$2" | head -n 20 >&2 || true
+        fail "$3"
+    fi
+}
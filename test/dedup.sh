@@ -0,0 +1,20 @@
+#!/bin/bash
+# Skipping duplicate lines gives the same counts as counting the text with
+# its duplicate lines removed beforehand, in both modes.
+#
+# Usage: dedup.sh <build_dir> <corpus.gz>
+
+source "$(dirname "$0")/common.sh" "$1" "$2"
+
+# every line of the first 5000 twice, then the others once
+{ cat "$corpus"; head -n 5000 "$corpus"; } > "$work_dir/text"
+awk '!seen[$0]++' "$work_dir/text" > "$work_dir/unique"
+
+for options in "" "--sentences"; do
+    run_count "$work_dir/unique" 3 "$work_dir/expected" $options
+    run_count "$work_dir/text" 3 "$work_dir/counts" --dedup $options
+    same "$work_dir/expected" "$work_dir/counts" \
+        "count --dedup${options:+ $options}"
+done
+
+echo "OK"
@@ -0,0 +1,31 @@
+#!/bin/bash
+# Sorted runs kept in memory give the same counts and the same model as
+# runs written to temporary files, plain or compressed.
+#
+# Usage: in_memory.sh <build_dir> <corpus.gz>
+
+source "$(dirname "$0")/common.sh" "$1" "$2"
+
+in_memory="sorted blocks fit in memory"
+
+run_count "$corpus" 3 "$work_dir/memory"
+grep -q "$in_memory" "$log" || fail "count did not keep the runs in memory"
+for options in "" "--compress_blocks"; do
+    run_count "$corpus" 3 "$work_dir/disk" --ram 0.005 $options
+    grep -q "$in_memory" "$log" && fail "count kept the runs in memory"
+    same "$work_dir/memory" "$work_dir/disk" \
+        "count --ram 0.005${options:+ $options}"
+done
+
+run_estimate "$corpus" 3 "$work_dir/memory.bin"
+grep -q "$in_memory" "$log" || fail "estimate did not keep the runs in memory"
+score "$work_dir/memory.bin" "$corpus" > "$work_dir/memory.score"
+for options in "" "--compress_blocks"; do
+    run_estimate "$corpus" 3 "$work_dir/disk.bin" --ram 0.005 $options
+    grep -q "$in_memory" "$log" && fail "estimate kept the runs in memory"
+    score "$work_dir/disk.bin" "$corpus" > "$work_dir/disk.score"
+    same "$work_dir/memory.score" "$work_dir/disk.score" \
+        "estimate --ram 0.005${options:+ $options}"
+done
+
+echo "OK"
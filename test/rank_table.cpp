@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "last/rank_table.hpp"
+
+/*
+    The rank given by rank_table must be the one given by log10 followed
+    by a search in the quantization levels, for every probability, with
+    the levels built by the index builder.
+*/
+
+using namespace tongrams;
+
+// the nearest level, as the search of the quantized sequences does
+struct nearest_level {
+    nearest_level(uint64_t bits, uint64_t reserved) : reserved(reserved) {
+        uint64_t num_levels = (uint64_t(1) << bits) - reserved;
+        float quantum = 1.0 / num_levels;
+        for (uint64_t i = 1; i != num_levels + 1; ++i) {
+            levels.push_back(std::log10(i * quantum));
+        }
+    }
+
+    uint64_t operator()(float value) const {
+        auto it = std::lower_bound(levels.begin(), levels.end(), value);
+        if (it == levels.end()) --it;
+        if (it != levels.begin() and value - *(it - 1) <= *it - value) --it;
+        return reserved + (it - levels.begin());
+    }
+
+    std::vector<float> levels;
+    uint64_t reserved;
+};
+
+static float value(uint32_t b) {
+    float x;
+    std::memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+static uint32_t bits_of(float x) {
+    uint32_t b;
+    std::memcpy(&b, &x, sizeof(b));
+    return b;
+}
+
+int main() {
+    uint32_t one = bits_of(1.0f);
+
+    uint64_t num_checked = 0;
+    for (uint64_t bits : {4, 8, 12, 16}) {
+        for (uint64_t reserved : {0, 1}) {
+            nearest_level rank(bits, reserved);
+            rank_table table;
+            table.build(rank);
+
+            auto check = [&](uint32_t b) {
+                float x = value(b);
+                uint64_t expected = rank(std::log10(x));
+                uint64_t got = table.rank(x, rank);
+                ++num_checked;
+                if (got == expected) return true;
+                std::cerr << "FAILED: bits = " << bits
+                          << ", reserved = " << reserved << ", x = " << x
+                          << ": rank " << got << " instead of " << expected
+                          << std::endl;
+                return false;
+            };
+
+            // the first and last values of every bucket, and a sample of
+            // the values in between, up to 1
+            uint32_t bucket = uint32_t(1) << rank_table::shift;
+            for (uint32_t b = 0; b <= one; b += bucket) {
+                if (!check(b)) return 1;
+                if (b + bucket - 1 <= one and !check(b + bucket - 1)) return 1;
+            }
+            for (uint32_t b = 0; b <= one; b += 4099) {
+                if (!check(b)) return 1;
+            }
+            // around the points where the rank changes: halfway between
+            // two levels
+            for (uint64_t i = 1; i < rank.levels.size(); ++i) {
+                float half = (rank.levels[i - 1] + rank.levels[i]) / 2;
+                uint32_t b = bits_of(std::pow(10.0f, half));
+                for (uint32_t d = 0; d != 5; ++d) {
+                    if (b + d >= 2 and b + d - 2 <= one and !check(b + d - 2)) {
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+
+    std::cout << "OK: " << num_checked << " values" << std::endl;
+    return 0;
+}
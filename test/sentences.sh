@@ -0,0 +1,31 @@
+#!/bin/bash
+# In sentence mode each line is padded with <s> and terminated by </s>,
+# blank lines and repeated spaces are not words, and no N-gram spans two
+# lines: the counts do not depend on the order of the lines.
+#
+# Usage: sentences.sh <build_dir> <corpus.gz>
+
+source "$(dirname "$0")/common.sh" "$1" "$2"
+
+printf 'a  b\n\n b a b \n' > "$work_dir/text"
+run_count "$work_dir/text" 3 "$work_dir/counts" --sentences
+{
+    printf '%-20s\n' 7
+    printf '%s\t%s\n' \
+        "<s> <s> <s>" 2 \
+        "<s> <s> a" 1 \
+        "<s> a b" 1 \
+        "a b </s>" 2 \
+        "<s> <s> b" 1 \
+        "<s> b a" 1 \
+        "b a b" 1 | sort
+} > "$work_dir/expected"
+same "$work_dir/expected" "$work_dir/counts" "count --sentences"
+
+run_count "$corpus" 3 "$work_dir/lines" --sentences
+sort "$corpus" > "$work_dir/sorted"
+run_count "$work_dir/sorted" 3 "$work_dir/sorted_lines" --sentences
+same "$work_dir/lines" "$work_dir/sorted_lines" \
+    "count --sentences on the sorted lines"
+
+echo "OK"
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Keeping the N-grams seen once out of the hash table gives the same
+# counts as the default path, with one block or with many, in both modes.
+#
+# Usage: singletons.sh <build_dir> <corpus.gz>
+
+source "$(dirname "$0")/common.sh" "$1" "$2"
+
+for mode in "" "--sentences"; do
+    run_count "$corpus" 3 "$work_dir/expected" $mode
+    for ram in "" "--ram 0.005"; do
+        options="--singletons${ram:+ $ram}${mode:+ $mode}"
+        run_count "$corpus" 3 "$work_dir/counts" $options
+        same "$work_dir/expected" "$work_dir/counts" "count $options"
+    done
+done
+
+echo "OK"
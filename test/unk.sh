@@ -0,0 +1,21 @@
+#!/bin/bash
+# Mapping the rare words to <unk> gives the same counts as counting the
+# text with those words replaced by <unk> beforehand, in both modes.
+#
+# Usage: unk.sh <build_dir> <corpus.gz>
+
+source "$(dirname "$0")/common.sh" "$1" "$2"
+
+# two passes: count the words, then replace those seen once
+awk 'NR == FNR { for (i = 1; i <= NF; ++i) ++n[$i]; next }
+     { for (i = 1; i <= NF; ++i) if (n[$i] < 2) $i = "<unk>"; print }' \
+    "$corpus" "$corpus" > "$work_dir/replaced"
+
+for options in "" "--sentences"; do
+    run_count "$work_dir/replaced" 3 "$work_dir/expected" $options
+    run_count "$corpus" 3 "$work_dir/counts" --min_unigram_count 2 $options
+    same "$work_dir/expected" "$work_dir/counts" \
+        "count --min_unigram_count 2${options:+ $options}"
+done
+
+echo "OK"